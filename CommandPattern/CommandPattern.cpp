@@ -1,6 +1,87 @@
 #include <iostream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
+/**
+ * 可以写入命令日志的命令类型，保存在日志记录中，重放时用来还原命令。
+ */
+enum CommandKind : uint8_t
+{
+    COMMAND_NONE = 0,
+    COMMAND_SIMPLE,
+    COMMAND_COMPLEX
+};
+
+/**
+ * 命令日志中的字符串：变长编码的长度加上字节内容。
+ */
+void appendString(string &out, const string &str)
+{
+    size_t length = str.size();
+    while (length >= 0x80)
+    {
+        out.push_back((char)(length | 0x80));
+        length >>= 7;
+    }
+    out.push_back((char)length);
+    out.append(str);
+}
+
+bool readString(const char *&p, const char *end, string &str)
+{
+    size_t length = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        if (p == end || shift > 63)
+        {
+            return false;
+        }
+        unsigned char byte = (unsigned char)*p++;
+        length |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+    }
+    if ((size_t)(end - p) < length)
+    {
+        return false;
+    }
+    str.assign(p, length);
+    p += length;
+    return true;
+}
+
 /**
  * Command接口声明了一个用于执行命令的方法。
  */
@@ -9,6 +90,14 @@ class Command
 public:
     virtual ~Command() {}
     virtual void execute() const = 0;
+
+    /**
+     * 把命令的参数序列化追加到out中，返回命令类型。不支持写入命令日志的命令返回COMMAND_NONE。
+     */
+    virtual CommandKind serialize(string &) const
+    {
+        return COMMAND_NONE;
+    }
 };
 
 /**
@@ -17,11 +106,16 @@ public:
 class SimpleCommand : public Command
 {
 public:
-    explicit SimpleCommand(string pay_load) : m_pay_load(pay_load) {}
+    explicit SimpleCommand(string pay_load) : m_pay_load(std::move(pay_load)) {}
     void execute() const override
     {
         cout << "SimpleCommand: this task is too simple and give it to me.\n";
     }
+    CommandKind serialize(string &out) const override
+    {
+        appendString(out, m_pay_load);
+        return COMMAND_SIMPLE;
+    }
 
 private:
     string m_pay_load;
@@ -29,6 +123,7 @@ private:
 
 /**
  * Receiver类包含一些重要的业务逻辑。他们知道如何执行与执行请求相关的各种操作。事实上，任何类都可以作为接收者。
+ * Receiver按顺序记录完成过的工作，崩溃后可以通过重放命令日志重建这些状态。
  */
 class Receiver
 {
@@ -36,11 +131,29 @@ public:
     void doTask(const string str)
     {
         cout << "Receiver: Working on " << str << ".\n";
+        record("task: " + str);
     }
     void doExtraTask(const string str)
     {
         cout << "Receiver: Working on extra task: " << str << ".\n";
+        record("extra task: " + str);
+    }
+
+    vector<string> history() const
+    {
+        lock_guard<mutex> lock(m_mutex);
+        return m_history;
+    }
+
+private:
+    void record(string entry)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_history.push_back(std::move(entry));
     }
+
+    mutable mutex m_mutex;
+    vector<string> m_history;
 };
 
 /**
@@ -53,7 +166,7 @@ public:
      * ComplexCommand可以通过构造函数接受一个或多个receiver对象以及任何上下文数据。
      */
     ComplexCommand(Receiver *receiver, string str1, string str2)
-        : m_receiver(receiver), m_str1(str1), m_str2(str2)
+        : m_receiver(receiver), m_str1(std::move(str1)), m_str2(std::move(str2))
     {
     }
 
@@ -67,12 +180,43 @@ public:
         this->m_receiver->doExtraTask(this->m_str2);
     }
 
+    /**
+     * Receiver不写入日志，重放时由调用方提供。
+     */
+    CommandKind serialize(string &out) const override
+    {
+        appendString(out, m_str1);
+        appendString(out, m_str2);
+        return COMMAND_COMPLEX;
+    }
+
 private:
     Receiver *m_receiver;
     string m_str1;
     string m_str2;
 };
 
+/**
+ * 只调用Receiver的一个方法的命令，可以把ComplexCommand拆成互相独立的子命令放进MacroCommand。
+ */
+class ReceiverCommand : public Command
+{
+public:
+    ReceiverCommand(Receiver *receiver, void (Receiver::*action)(const string), string str)
+        : m_receiver(receiver), m_action(action), m_str(std::move(str))
+    {
+    }
+    void execute() const override
+    {
+        (this->m_receiver->*m_action)(this->m_str);
+    }
+
+private:
+    Receiver *m_receiver;
+    void (Receiver::*m_action)(const string);
+    string m_str;
+};
+
 class Invoker
 {
 public:
@@ -112,19 +256,1503 @@ private:
     Command *m_end;
 };
 
-void clientCode()
+/**
+ * 只追加的命令日志。每条记录为[4字节长度][4字节CRC32][1字节CommandKind][命令参数]，命令在写入日志并落盘之后才执行。
+ * SYNC_EACH模式下每条命令单独write+fsync；GROUP_COMMIT模式下并发提交的命令在内存中排队，
+ * 由其中一个线程(leader)一次写入并fsync，其他线程等待包含自己记录的那一批落盘，一次fsync确认多条命令。
+ * 并发提交的命令按照它们在日志中的顺序依次执行，所以现场的Receiver状态与重放得到的完全一致。
+ * 打开日志时会截掉崩溃留下的不完整记录；replay按顺序重新执行日志中的命令，重建Receiver的状态。
+ */
+class CommandJournal
 {
-    Invoker *invoker = new Invoker;
-    invoker->setStart(new SimpleCommand("Say Hi!"));
-    Receiver *receiver = new Receiver;
-    invoker->setFinish(new ComplexCommand(receiver, "Send Email", "Save report"));
-    invoker->doSomethingImportant();
+public:
+    enum SyncMode
+    {
+        SYNC_EACH,
+        GROUP_COMMIT
+    };
 
-    delete invoker, receiver;
-}
+    explicit CommandJournal(const string &path, SyncMode mode = GROUP_COMMIT) : m_mode(mode)
+    {
+        size_t validLength = forEachRecord(readFile(path), [](CommandKind, const char *, const char *) {});
+#ifdef _WIN32
+        m_fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+        m_failed = m_fd < 0 || _chsize_s(m_fd, validLength) != 0 || _lseeki64(m_fd, 0, SEEK_END) < 0;
+#else
+        m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        m_failed = m_fd < 0 || ftruncate(m_fd, validLength) != 0;
+#endif
+    }
+    ~CommandJournal()
+    {
+        if (m_fd >= 0)
+        {
+#ifdef _WIN32
+            _close(m_fd);
+#else
+            close(m_fd);
+#endif
+        }
+    }
+    CommandJournal(const CommandJournal &) = delete;
+    CommandJournal &operator=(const CommandJournal &) = delete;
+
+    bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    /**
+     * 把命令写入日志并等待落盘。命令不支持日志或者写入失败时返回false；一旦写入失败，之后的追加都返回false。
+     */
+    bool append(const Command &cmd)
+    {
+        return appendInOrder(cmd, false);
+    }
+
+    /**
+     * 先持久化再执行，执行顺序与日志中的记录顺序相同。返回false时命令没有执行。
+     */
+    bool execute(const Command &cmd)
+    {
+        return appendInOrder(cmd, true);
+    }
+
+    size_t syncCount() const
+    {
+        return m_syncs.load(memory_order_relaxed);
+    }
+
+    /**
+     * 按顺序执行日志中的所有完整记录，ComplexCommand作用在receiver上。返回重放的命令数。
+     */
+    static size_t replay(const string &path, Receiver *receiver)
+    {
+        size_t count = 0;
+        forEachRecord(readFile(path), [&](CommandKind kind, const char *p, const char *end)
+                      {
+            unique_ptr<Command> cmd(decode(kind, p, end, receiver));
+            if (cmd)
+            {
+                cmd->execute();
+                count++;
+            } });
+        return count;
+    }
+
+private:
+    static const size_t kHeaderSize = 2 * sizeof(uint32_t);
+
+    /**
+     * 等待执行的一条记录，放在提交线程的栈上，提交线程在这批记录落盘并执行完之前一直等待。
+     */
+    struct PendingCommand
+    {
+        const Command *m_command; // 只写日志不执行时为nullptr
+        exception_ptr m_error;
+    };
+
+    /**
+     * 写入并等待落盘，run为true时再执行命令。GROUP_COMMIT模式下由leader在fsync之后、
+     * 交出leader身份之前按记录顺序执行整批命令，所以执行顺序与日志顺序一致；
+     * 命令抛出的异常保存下来，由提交它的线程重新抛出。
+     */
+    bool appendInOrder(const Command &cmd, bool run)
+    {
+        string record(kHeaderSize, '\0');
+        CommandKind kind = cmd.serialize(record);
+        if (kind == COMMAND_NONE)
+        {
+            return false;
+        }
+        record.insert(record.begin() + kHeaderSize, (char)kind);
+        uint32_t length = (uint32_t)(record.size() - kHeaderSize);
+        uint32_t crc = crc32(record.data() + kHeaderSize, length);
+        memcpy(&record[0], &length, sizeof(length));
+        memcpy(&record[sizeof(length)], &crc, sizeof(crc));
+
+        unique_lock<mutex> lock(m_mutex);
+        if (m_failed)
+        {
+            return false;
+        }
+        if (m_mode == SYNC_EACH)
+        {
+            m_failed = !writeAndSync(record);
+            if (!m_failed && run)
+            {
+                cmd.execute();
+            }
+            return !m_failed;
+        }
+
+        PendingCommand pending{run ? &cmd : nullptr, nullptr};
+        m_pending += record;
+        m_pendingCommands.push_back(&pending);
+        uint64_t sequence = ++m_appended;
+        while (m_durable < sequence)
+        {
+            if (m_flushing)
+            {
+                m_flushed.wait(lock);
+                continue;
+            }
+            // 成为leader：带走目前排队的所有记录，在锁外写入、fsync并执行
+            m_flushing = true;
+            string batch;
+            batch.swap(m_pending);
+            vector<PendingCommand *> commands;
+            commands.swap(m_pendingCommands);
+            uint64_t batchEnd = m_appended;
+            bool failed = m_failed;
+            lock.unlock();
+            failed = failed || !writeAndSync(batch);
+            for (PendingCommand *command : commands)
+            {
+                if (failed || command->m_command == nullptr)
+                {
+                    continue;
+                }
+                try
+                {
+                    command->m_command->execute();
+                }
+                catch (...)
+                {
+                    command->m_error = current_exception();
+                }
+            }
+            lock.lock();
+            m_flushing = false;
+            m_failed = failed;
+            m_durable = batchEnd;
+            m_flushed.notify_all();
+        }
+        if (pending.m_error)
+        {
+            rethrow_exception(pending.m_error);
+        }
+        return !m_failed;
+    }
+
+    static string readFile(const string &path)
+    {
+        ifstream in(path, ios::binary);
+        return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+
+    /**
+     * 对每条完整且校验通过的记录调用f(kind, 参数开始, 参数结束)，遇到不完整或损坏的记录时停止。
+     * 返回有效记录的总长度。
+     */
+    template <typename F>
+    static size_t forEachRecord(const string &data, F f)
+    {
+        size_t offset = 0;
+        while (data.size() - offset >= kHeaderSize)
+        {
+            uint32_t length, crc;
+            memcpy(&length, &data[offset], sizeof(length));
+            memcpy(&crc, &data[offset + sizeof(length)], sizeof(crc));
+            const char *body = data.data() + offset + kHeaderSize;
+            if (length == 0 || data.size() - offset - kHeaderSize < length || crc32(body, length) != crc)
+            {
+                break;
+            }
+            f((CommandKind)body[0], body + 1, body + length);
+            offset += kHeaderSize + length;
+        }
+        return offset;
+    }
+
+    static Command *decode(CommandKind kind, const char *p, const char *end, Receiver *receiver)
+    {
+        string str1, str2;
+        switch (kind)
+        {
+        case COMMAND_SIMPLE:
+            return readString(p, end, str1) ? new SimpleCommand(std::move(str1)) : nullptr;
+        case COMMAND_COMPLEX:
+            return readString(p, end, str1) && readString(p, end, str2)
+                       ? new ComplexCommand(receiver, std::move(str1), std::move(str2))
+                       : nullptr;
+        default:
+            return nullptr;
+        }
+    }
+
+    static uint32_t crc32(const char *data, size_t size)
+    {
+        static const auto table = []
+        {
+            array<uint32_t, 256> entries;
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[i] = c;
+            }
+            return entries;
+        }();
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    bool writeAndSync(const string &data)
+    {
+        size_t written = 0;
+        while (written < data.size())
+        {
+#ifdef _WIN32
+            int n = _write(m_fd, data.data() + written, (unsigned)(data.size() - written));
+#else
+            ssize_t n = write(m_fd, data.data() + written, data.size() - written);
+#endif
+            if (n <= 0)
+            {
+                return false;
+            }
+            written += (size_t)n;
+        }
+        m_syncs.fetch_add(1, memory_order_relaxed);
+#ifdef _WIN32
+        return _commit(m_fd) == 0;
+#elif defined(__APPLE__)
+        return fcntl(m_fd, F_FULLFSYNC) == 0 || fsync(m_fd) == 0;
+#else
+        return fdatasync(m_fd) == 0;
+#endif
+    }
+
+    SyncMode m_mode;
+    int m_fd;
+    mutex m_mutex;
+    condition_variable m_flushed;
+    string m_pending;
+    vector<PendingCommand *> m_pendingCommands;
+    uint64_t m_appended = 0;
+    uint64_t m_durable = 0;
+    bool m_flushing = false;
+    bool m_failed = false;
+    atomic<size_t> m_syncs{0};
+
+};
+
+/**
+ * 值语义的类型擦除命令：可以保存任何带有`void execute() const`的类型(包括Command的子类本身)。
+ * 不超过kInlineSize字节、对齐不超过max_align_t并且可以无异常移动的命令直接构造在内部缓冲区中，不分配堆内存；
+ * 更大的命令退回到堆上，缓冲区中只保存指针。
+ */
+class InlineCommand
+{
+public:
+    // 足够放下ComplexCommand(虚表指针、Receiver指针和两个string)
+    static const size_t kInlineSize = 80;
+
+    template <typename T>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(T) <= kInlineSize && alignof(T) <= alignof(max_align_t) &&
+               is_nothrow_move_constructible<T>::value;
+    }
+
+    InlineCommand() noexcept {}
+
+    template <typename T, typename = typename enable_if<!is_same<typename decay<T>::type, InlineCommand>::value>::type>
+    InlineCommand(T &&command)
+    {
+        emplace<typename decay<T>::type>(std::forward<T>(command));
+    }
+
+    InlineCommand(InlineCommand &&other) noexcept
+    {
+        moveFrom(other);
+    }
+    InlineCommand &operator=(InlineCommand &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+    InlineCommand(const InlineCommand &) = delete;
+    InlineCommand &operator=(const InlineCommand &) = delete;
+    ~InlineCommand()
+    {
+        reset();
+    }
+
+    /**
+     * 销毁当前保存的命令，然后用args原地构造一个T。
+     */
+    template <typename T, typename... Args>
+    void emplace(Args &&...args)
+    {
+        reset();
+        if constexpr (fitsInline<T>())
+        {
+            ::new ((void *)m_buffer) T(std::forward<Args>(args)...);
+            m_ops = &InlineOps<T>::kOps;
+        }
+        else
+        {
+            *reinterpret_cast<T **>(m_buffer) = new T(std::forward<Args>(args)...);
+            m_ops = &HeapOps<T>::kOps;
+        }
+    }
+
+    void execute() const
+    {
+        m_ops->m_execute(m_buffer);
+    }
+
+    void reset() noexcept
+    {
+        if (m_ops)
+        {
+            m_ops->m_destroy(m_buffer);
+            m_ops = nullptr;
+        }
+    }
+
+    explicit operator bool() const
+    {
+        return m_ops != nullptr;
+    }
+
+    bool isInline() const
+    {
+        return m_ops != nullptr && m_ops->m_inline;
+    }
 
-int main(void)
+private:
+    struct Ops
+    {
+        void (*m_execute)(const void *);
+        void (*m_move)(void *from, void *to);
+        void (*m_destroy)(void *);
+        bool m_inline;
+    };
+
+    template <typename T>
+    struct InlineOps
+    {
+        static void execute(const void *p)
+        {
+            static_cast<const T *>(p)->execute();
+        }
+        static void move(void *from, void *to)
+        {
+            ::new (to) T(std::move(*static_cast<T *>(from)));
+            static_cast<T *>(from)->~T();
+        }
+        static void destroy(void *p)
+        {
+            static_cast<T *>(p)->~T();
+        }
+        static constexpr Ops kOps = {&execute, &move, &destroy, true};
+    };
+
+    template <typename T>
+    struct HeapOps
+    {
+        static void execute(const void *p)
+        {
+            (*static_cast<T *const *>(p))->execute();
+        }
+        static void move(void *from, void *to)
+        {
+            *static_cast<T **>(to) = *static_cast<T **>(from);
+        }
+        static void destroy(void *p)
+        {
+            delete *static_cast<T **>(p);
+        }
+        static constexpr Ops kOps = {&execute, &move, &destroy, false};
+    };
+
+    void moveFrom(InlineCommand &other) noexcept
+    {
+        if (other.m_ops)
+        {
+            other.m_ops->m_move(other.m_buffer, m_buffer);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    const Ops *m_ops = nullptr;
+    alignas(max_align_t) unsigned char m_buffer[kInlineSize];
+};
+
+/**
+ * 让InlineCommand接管一个堆上的Command对象，用于兼容原来按指针传递命令的接口。
+ */
+class OwnedCommand
+{
+public:
+    explicit OwnedCommand(Command *command) : m_command(command) {}
+    void execute() const
+    {
+        m_command->execute();
+    }
+
+private:
+    unique_ptr<Command> m_command;
+};
+
+/**
+ * 有界的多生产者多消费者无锁队列(Vyukov算法)。每个槽位带一个序号：
+ * 序号等于入队位置时槽位可写，等于入队位置+1时槽位可读。生产者/消费者用CAS抢占位置，之后只访问自己的槽位。
+ */
+template <typename T>
+class MpmcQueue
 {
+public:
+    explicit MpmcQueue(size_t capacity) : m_mask(roundUpToPowerOfTwo(capacity) - 1), m_cells(new Cell[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; i++)
+        {
+            m_cells[i].m_sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    bool tryPush(T &&value)
+    {
+        return tryPushWith([&](T &slot)
+                           { slot = std::move(value); });
+    }
+
+    /**
+     * 抢到槽位后调用init(slot)直接在槽位中写入元素，避免先构造再移动。队列满时不调用init，返回false。
+     */
+    template <typename Init>
+    bool tryPushWith(Init &&init)
+    {
+        size_t pos = m_enqueuePos.load(memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = m_cells[pos & m_mask];
+            size_t sequence = cell.m_sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    init(cell.m_value);
+                    cell.m_sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // 队列已满
+            }
+            else
+            {
+                pos = m_enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T &value)
+    {
+        size_t pos = m_dequeuePos.load(memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = m_cells[pos & m_mask];
+            size_t sequence = cell.m_sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    value = std::move(cell.m_value);
+                    cell.m_sequence.store(pos + m_mask + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // 队列为空
+            }
+            else
+            {
+                pos = m_dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        atomic<size_t> m_sequence;
+        T m_value;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 2;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    const size_t m_mask;
+    unique_ptr<Cell[]> m_cells;
+    alignas(64) atomic<size_t> m_enqueuePos{0};
+    alignas(64) atomic<size_t> m_dequeuePos{0};
+};
+
+/**
+ * 异步的Invoker：命令通过无锁队列提交，由固定数量的工作线程执行。
+ * 与Invoker一样，AsyncInvoker接管提交给它的命令，执行完后负责释放。
+ * 队列满时提交方自旋等待(背压)；工作线程空闲时先自旋，之后在条件变量上休眠，提交方只在有线程休眠时才去唤醒。
+ * shutdown()停止接受新命令，等已经提交的命令全部执行完后再回收线程。
+ */
+class AsyncInvoker
+{
+public:
+    explicit AsyncInvoker(size_t workerCount = thread::hardware_concurrency(), size_t queueCapacity = 4096)
+        : m_queue(queueCapacity)
+    {
+        workerCount = workerCount == 0 ? 1 : workerCount;
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            m_workers.emplace_back(&AsyncInvoker::workerLoop, this);
+        }
+    }
+    ~AsyncInvoker()
+    {
+        shutdown();
+    }
+    AsyncInvoker(const AsyncInvoker &) = delete;
+    AsyncInvoker &operator=(const AsyncInvoker &) = delete;
+
+    /**
+     * 提交命令并返回完成的future；命令抛出的异常会通过future传给调用方。shutdown之后提交会抛出logic_error。
+     */
+    future<void> submit(Command *cmd)
+    {
+        return submit<OwnedCommand>(OwnedCommand(cmd));
+    }
+
+    /**
+     * 提交命令，不关心何时完成。命令抛出的异常只计入failedCount()。
+     */
+    void post(Command *cmd)
+    {
+        post<OwnedCommand>(OwnedCommand(cmd));
+    }
+
+    /**
+     * 用args在队列槽位中直接构造一个T类型的命令(T只需要有`void execute() const`)。
+     * T满足InlineCommand::fitsInline时，除了future的共享状态外不分配堆内存。
+     */
+    template <typename T, typename... Args>
+    future<void> submit(Args &&...args)
+    {
+        optional<promise<void>> done(in_place);
+        future<void> result = done->get_future();
+        enqueue<T>(done, std::forward<Args>(args)...);
+        return result;
+    }
+
+    template <typename T, typename... Args>
+    void post(Args &&...args)
+    {
+        optional<promise<void>> done;
+        enqueue<T>(done, std::forward<Args>(args)...);
+    }
+
+    /**
+     * 与post相同，但从不等待也不抛出：队列已满或者已经shutdown时不提交，返回false。
+     * 工作线程向自己所在的线程池提交任务时要用tryPost，否则所有线程都可能卡在满队列上。
+     */
+    template <typename T, typename... Args>
+    bool tryPost(Args &&...args)
+    {
+        static_assert(is_nothrow_constructible<T, Args &&...>::value, "tryPost requires a nothrow constructor");
+        m_submitting.fetch_add(1);
+        bool pushed = m_accepting.load() && m_queue.tryPushWith([&](Task &slot)
+                                                                {
+            slot.m_command.emplace<T>(std::forward<Args>(args)...);
+            slot.m_done.reset(); });
+        finishSubmit();
+        return pushed;
+    }
+
+    /**
+     * 停止接受新命令，等待队列中的命令全部执行完毕。可以重复调用。
+     */
+    void shutdown()
+    {
+        m_accepting.store(false);
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_idleCondition.notify_all();
+        }
+        for (thread &worker : m_workers)
+        {
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+    }
+
+    size_t executedCount() const
+    {
+        return m_executed.load(memory_order_relaxed);
+    }
+    size_t failedCount() const
+    {
+        return m_failed.load(memory_order_relaxed);
+    }
+
+private:
+    // promise直接放在槽位里随任务移动，post提交的任务没有promise
+    struct Task
+    {
+        InlineCommand m_command;
+        optional<promise<void>> m_done;
+    };
+
+    template <typename T, typename... Args>
+    void enqueue(optional<promise<void>> &done, Args &&...args)
+    {
+        // 先登记再检查m_accepting：shutdown之后工作线程要等所有登记过的提交完成才会退出
+        m_submitting.fetch_add(1);
+        if (!m_accepting.load())
+        {
+            finishSubmit();
+            throw logic_error("AsyncInvoker: submit after shutdown");
+        }
+        if constexpr (is_nothrow_constructible<T, Args &&...>::value)
+        {
+            for (int spins = 0; !m_queue.tryPushWith([&](Task &slot)
+                                                     {
+                slot.m_command.emplace<T>(std::forward<Args>(args)...);
+                slot.m_done = std::move(done); });
+                 spins++)
+            {
+                backoff(spins);
+            }
+        }
+        else
+        {
+            // 构造可能抛出异常，而抢到的槽位必须发布出去，所以先在槽位外构造，再无异常地移动进去
+            InlineCommand command;
+            try
+            {
+                command.emplace<T>(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                finishSubmit();
+                throw;
+            }
+            for (int spins = 0; !m_queue.tryPushWith([&](Task &slot)
+                                                     {
+                slot.m_command = std::move(command);
+                slot.m_done = std::move(done); });
+                 spins++)
+            {
+                backoff(spins);
+            }
+        }
+        finishSubmit();
+    }
+
+    /**
+     * 结束一次提交(无论是否成功入队)。shutdown之后，休眠的工作线程可能因为还有提交在进行而再次休眠，
+     * 所以这时要唤醒全部工作线程，让它们重新检查是否可以退出。
+     */
+    void finishSubmit()
+    {
+        m_submitting.fetch_sub(1);
+        // 与workerLoop中的栅栏配对：要么这里看到空闲线程，要么空闲线程再次检查时看到刚提交的命令
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!m_accepting.load())
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_idleCondition.notify_all();
+        }
+        else if (m_idleWorkers.load() > 0)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_idleCondition.notify_one();
+        }
+    }
+
+    void workerLoop()
+    {
+        Task task;
+        for (;;)
+        {
+            int spins = 0;
+            while (!m_queue.tryPop(task))
+            {
+                if (!m_accepting.load() && m_submitting.load() == 0)
+                {
+                    // 不再有新的提交；最后检查一次队列，确实为空才退出
+                    if (!m_queue.tryPop(task))
+                    {
+                        return;
+                    }
+                    break;
+                }
+                if (++spins < 128)
+                {
+                    this_thread::yield();
+                    continue;
+                }
+                // 登记为空闲后再检查一次队列，提交方push之后会看到m_idleWorkers > 0，不会丢失唤醒
+                unique_lock<mutex> lock(m_mutex);
+                m_idleWorkers.fetch_add(1);
+                atomic_thread_fence(memory_order_seq_cst);
+                m_idleCondition.wait(lock, [&]
+                                     { return m_queue.tryPop(task) || (!m_accepting.load() && m_submitting.load() == 0); });
+                m_idleWorkers.fetch_sub(1);
+                if (task.m_command)
+                {
+                    break;
+                }
+                spins = 0;
+            }
+            run(task);
+        }
+    }
+
+    void run(Task &task)
+    {
+        try
+        {
+            task.m_command.execute();
+            if (task.m_done)
+            {
+                task.m_done->set_value();
+            }
+        }
+        catch (...)
+        {
+            m_failed.fetch_add(1, memory_order_relaxed);
+            if (task.m_done)
+            {
+                task.m_done->set_exception(current_exception());
+            }
+        }
+        task.m_command.reset();
+        task.m_done.reset();
+        m_executed.fetch_add(1, memory_order_relaxed);
+    }
+
+    static void backoff(int spins)
+    {
+        if (spins >= 64)
+        {
+            this_thread::yield();
+        }
+    }
+
+    MpmcQueue<Task> m_queue;
+    vector<thread> m_workers;
+    atomic<bool> m_accepting{true};
+    atomic<size_t> m_submitting{0};
+    atomic<size_t> m_idleWorkers{0};
+    atomic<size_t> m_executed{0};
+    atomic<size_t> m_failed{0};
+    mutex m_mutex;
+    condition_variable m_idleCondition;
+};
+
+/**
+ * MacroCommand::run的统计结果(毫秒)。totalWork是所有子命令耗时之和，criticalPath是依赖图中最长一条路径的耗时，
+ * 两者之比是这个图理论上的最大并行度。
+ */
+struct MacroReport
+{
+    double m_wallMs = 0;
+    double m_totalWorkMs = 0;
+    double m_criticalPathMs = 0;
+};
+
+/**
+ * 带依赖关系的组合命令。子命令通过add声明依赖的子命令(只能依赖之前添加的，因此不会有环)。
+ * 执行时没有依赖的子命令在AsyncInvoker的线程池上并发执行，一个子命令的所有依赖完成后立即开始：
+ * 完成子命令的线程直接接着执行一个刚就绪的后继，其余就绪的后继用tryPost提交给线程池；
+ * 线程池队列已满(或已经shutdown)时放进这次执行自己的待执行列表，由提交失败的线程在完成手头的子命令后继续执行。
+ * 子命令抛出异常时，依赖它的子命令不再执行，execute在所有子命令结束后重新抛出第一个异常。
+ * 没有线程池时按添加顺序在调用线程上依次执行。
+ * 注意execute会阻塞等待全部子命令完成，不要在同一个线程池的工作线程上执行MacroCommand。
+ */
+class MacroCommand : public Command
+{
+public:
+    explicit MacroCommand(AsyncInvoker *pool = nullptr) : m_pool(pool) {}
+    ~MacroCommand()
+    {
+        for (Command *child : m_children)
+        {
+            delete child;
+        }
+    }
+    MacroCommand(const MacroCommand &) = delete;
+    MacroCommand &operator=(const MacroCommand &) = delete;
+
+    /**
+     * 添加一个子命令(由MacroCommand负责释放)，返回它的编号，供之后的子命令声明依赖。
+     */
+    size_t add(Command *child, const vector<size_t> &dependsOn = {})
+    {
+        size_t index = m_children.size();
+        for (size_t dependency : dependsOn)
+        {
+            if (dependency >= index)
+            {
+                delete child;
+                throw invalid_argument("MacroCommand: a child can only depend on earlier children");
+            }
+        }
+        m_children.push_back(child);
+        m_dependencies.push_back(dependsOn);
+        m_dependents.emplace_back();
+        for (size_t dependency : dependsOn)
+        {
+            m_dependents[dependency].push_back(index);
+        }
+        return index;
+    }
+
+    size_t size() const
+    {
+        return m_children.size();
+    }
+
+    void execute() const override
+    {
+        run();
+    }
+
+    /**
+     * 执行所有子命令并返回耗时统计。
+     */
+    MacroReport run() const
+    {
+        size_t n = m_children.size();
+        RunState state(n);
+        auto start = chrono::steady_clock::now();
+        if (m_pool == nullptr)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                runOne(state, i);
+            }
+        }
+        else if (n > 0)
+        {
+            state.m_unfinished.store(n, memory_order_relaxed);
+            vector<size_t> roots;
+            for (size_t i = 0; i < n; i++)
+            {
+                state.m_remaining[i].store(m_dependencies[i].size(), memory_order_relaxed);
+                if (m_dependencies[i].empty())
+                {
+                    roots.push_back(i);
+                }
+            }
+            // 第一个根在调用线程上执行，其余交给线程池
+            for (size_t r = 1; r < roots.size(); r++)
+            {
+                schedule(state, roots[r]);
+            }
+            runFrom(state, roots[0]);
+            unique_lock<mutex> lock(state.m_mutex);
+            state.m_finished.wait(lock, [&]
+                                  { return state.m_done; });
+        }
+        MacroReport report;
+        report.m_wallMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        vector<double> finish(n, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            double ready = 0;
+            for (size_t dependency : m_dependencies[i])
+            {
+                ready = std::max(ready, finish[dependency]);
+            }
+            finish[i] = ready + state.m_durationMs[i];
+            report.m_totalWorkMs += state.m_durationMs[i];
+            report.m_criticalPathMs = std::max(report.m_criticalPathMs, finish[i]);
+        }
+        if (state.m_error)
+        {
+            rethrow_exception(state.m_error);
+        }
+        return report;
+    }
+
+private:
+    /**
+     * 一次run的状态，放在调用线程的栈上，run返回前所有子命令都已经结束。
+     */
+    struct RunState
+    {
+        explicit RunState(size_t n)
+            : m_remaining(new atomic<size_t>[n]), m_blocked(new atomic<bool>[n]), m_durationMs(n, 0)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                m_blocked[i].store(false, memory_order_relaxed);
+            }
+        }
+
+        unique_ptr<atomic<size_t>[]> m_remaining; // 每个子命令还没完成的依赖数
+        unique_ptr<atomic<bool>[]> m_blocked;     // 某个依赖失败了，不再执行
+        vector<double> m_durationMs;              // 每个元素只由执行该子命令的线程写入
+        atomic<size_t> m_unfinished{0};
+        mutex m_mutex;
+        condition_variable m_finished;
+        bool m_done = false;
+        exception_ptr m_error;
+        vector<size_t> m_overflow; // 线程池队列满时暂存的就绪子命令，由m_mutex保护
+    };
+
+    /**
+     * 提交给线程池的任务，只有三个指针大小，可以直接放进InlineCommand。
+     */
+    struct ChildTask
+    {
+        ChildTask(const MacroCommand *macro, RunState *state, size_t index) noexcept
+            : m_macro(macro), m_state(state), m_index(index)
+        {
+        }
+
+        const MacroCommand *m_macro;
+        RunState *m_state;
+        size_t m_index;
+
+        void execute() const
+        {
+            m_macro->runFrom(*m_state, m_index);
+        }
+    };
+
+    /**
+     * 执行一个子命令，失败时记录异常并返回false。
+     */
+    bool runOne(RunState &state, size_t index) const
+    {
+        bool ok = !state.m_blocked[index].load(memory_order_relaxed);
+        for (size_t dependency : m_dependencies[index])
+        {
+            // 顺序执行时依赖失败的子命令也通过m_blocked传递
+            ok = ok && !state.m_blocked[dependency].load(memory_order_relaxed);
+        }
+        if (!ok)
+        {
+            state.m_blocked[index].store(true, memory_order_relaxed);
+            return false;
+        }
+        auto start = chrono::steady_clock::now();
+        try
+        {
+            m_children[index]->execute();
+        }
+        catch (...)
+        {
+            lock_guard<mutex> lock(state.m_mutex);
+            if (!state.m_error)
+            {
+                state.m_error = current_exception();
+            }
+            ok = false;
+        }
+        state.m_durationMs[index] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (!ok)
+        {
+            state.m_blocked[index].store(true, memory_order_relaxed);
+        }
+        return ok;
+    }
+
+    /**
+     * 执行一个子命令，然后沿着刚就绪的后继继续执行，直到没有就绪的后继。
+     */
+    void runFrom(RunState &state, size_t index) const
+    {
+        const size_t none = (size_t)-1;
+        while (index != none)
+        {
+            bool ok = runOne(state, index);
+            size_t next = none;
+            for (size_t dependent : m_dependents[index])
+            {
+                if (!ok)
+                {
+                    state.m_blocked[dependent].store(true, memory_order_relaxed);
+                }
+                if (state.m_remaining[dependent].fetch_sub(1, memory_order_acq_rel) == 1)
+                {
+                    if (next == none)
+                    {
+                        next = dependent;
+                    }
+                    else
+                    {
+                        schedule(state, dependent);
+                    }
+                }
+            }
+            if (next == none)
+            {
+                next = takeOverflow(state);
+            }
+            // 最后一个子命令完成后run可能立即返回并销毁state，所以之后不能再访问state
+            if (state.m_unfinished.fetch_sub(1, memory_order_acq_rel) == 1)
+            {
+                lock_guard<mutex> lock(state.m_mutex);
+                state.m_done = true;
+                state.m_finished.notify_all();
+            }
+            index = next;
+        }
+    }
+
+    /**
+     * 把就绪的子命令交给线程池。这里不能等待队列腾出空间：调用方可能就是线程池的工作线程。
+     * 每个提交出去的ChildTask都对应一个未完成的子命令，所以run返回前它们都已经执行完，不会访问已经销毁的RunState。
+     */
+    void schedule(RunState &state, size_t index) const
+    {
+        if (!m_pool->tryPost<ChildTask>(this, &state, index))
+        {
+            lock_guard<mutex> lock(state.m_mutex);
+            state.m_overflow.push_back(index);
+        }
+    }
+
+    size_t takeOverflow(RunState &state) const
+    {
+        lock_guard<mutex> lock(state.m_mutex);
+        if (state.m_overflow.empty())
+        {
+            return (size_t)-1;
+        }
+        size_t index = state.m_overflow.back();
+        state.m_overflow.pop_back();
+        return index;
+    }
+
+    AsyncInvoker *m_pool;
+    vector<Command *> m_children;
+    vector<vector<size_t>> m_dependencies;
+    vector<vector<size_t>> m_dependents;
+};
+
+void clientCode()
+{
+    Invoker *invoker = new Invoker;
+    invoker->setStart(new SimpleCommand("Say Hi!"));
+    Receiver *receiver = new Receiver;
+    invoker->setFinish(new ComplexCommand(receiver, "Send Email", "Save report"));
+    invoker->doSomethingImportant();
+
+    delete invoker, receiver;
+}
+
+/**
+ * 异步Invoker的客户端代码：提交后拿到future，等命令执行完再继续。
+ */
+void asyncClientCode()
+{
+    AsyncInvoker invoker(2);
+    Receiver receiver;
+    cout << "AsyncInvoker: start something...\n";
+    invoker.submit(new SimpleCommand("Say Hi!")).get();
+    cout << "AsyncInvoker: Important ongoing...\n";
+    // 命令也可以直接构造在队列槽位中，不需要单独new
+    invoker.submit<ComplexCommand>(&receiver, "Send Email", "Save report").get();
+    invoker.shutdown();
+    cout << "AsyncInvoker: executed " << invoker.executedCount() << " commands.\n";
+}
+
+/**
+ * 组合命令的客户端代码：doTask和doExtraTask互不依赖，可以并发执行；最后的命令要等两者都完成。
+ * 子命令的输出在多个线程上会交错，演示时先关闭，结束后打印Receiver记录的结果。
+ */
+void macroClientCode()
+{
+    AsyncInvoker pool(2);
+    Receiver receiver;
+    MacroCommand macro(&pool);
+    size_t email = macro.add(new ReceiverCommand(&receiver, &Receiver::doTask, "Send Email"));
+    size_t report = macro.add(new ReceiverCommand(&receiver, &Receiver::doExtraTask, "Save report"));
+    macro.add(new ReceiverCommand(&receiver, &Receiver::doTask, "Archive"), {email, report});
+
+    cout << "MacroCommand: running " << macro.size() << " children on a pool...\n";
+    cout.setstate(ios::badbit);
+    macro.execute();
+    cout.clear();
+    for (const string &entry : receiver.history())
+    {
+        cout << "Receiver: done " << entry << ".\n";
+    }
+}
+
+/**
+ * 命令日志的客户端代码：先写日志再执行，模拟崩溃后用日志重建Receiver的状态。
+ */
+void journalClientCode()
+{
+    string path = (filesystem::temp_directory_path() / "command_journal_demo.log").string();
+    filesystem::remove(path);
+    Receiver receiver;
+    {
+        CommandJournal journal(path);
+        journal.execute(SimpleCommand("Say Hi!"));
+        journal.execute(ComplexCommand(&receiver, "Send Email", "Save report"));
+    }
+    // 模拟崩溃时只写了一半的记录
+    {
+        ofstream out(path, ios::binary | ios::app);
+        out.write("\x40\0\0\0\x12\x34", 6);
+    }
+
+    cout << "CommandJournal: replaying after crash...\n";
+    Receiver recovered;
+    size_t replayed = CommandJournal::replay(path, &recovered);
+    cout << "CommandJournal: replayed " << replayed << " commands, receiver state "
+         << (recovered.history() == receiver.history() ? "restored" : "MISMATCH") << ".\n";
+    filesystem::remove(path);
+}
+
+/**
+ * 以下为性能测试代码，通过 `--bench` 参数运行
+ * 测试用命令类型的堆分配计数。命令类型继承AllocationCounter，用类专属的operator new/delete计数；
+ * 命令内部的字符串用CountingAllocator计数。只统计这些测试类型，不影响程序中的其他分配。
+ */
+struct AllocationCounter
+{
+    static inline atomic<size_t> s_allocations{0};
+
+    static void *operator new(size_t size)
+    {
+        s_allocations.fetch_add(1, memory_order_relaxed);
+        return ::operator new(size);
+    }
+    static void operator delete(void *p) noexcept
+    {
+        ::operator delete(p);
+    }
+};
+
+template <typename T>
+struct CountingAllocator
+{
+    using value_type = T;
+
+    CountingAllocator() noexcept {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        AllocationCounter::s_allocations.fetch_add(1, memory_order_relaxed);
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t) noexcept
+    {
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U> &) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U> &) const noexcept
+    {
+        return false;
+    }
+};
+
+using CountedString = basic_string<char, char_traits<char>, CountingAllocator<char>>;
+
+template <typename F>
+double measureMs(F f)
+{
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * 几乎不做事的命令，测试的是提交、排队和调度本身的开销。
+ */
+class CountingCommand : public Command, public AllocationCounter
+{
+public:
+    explicit CountingCommand(atomic<size_t> *counter) : m_counter(counter) {}
+    void execute() const override
+    {
+        m_counter->fetch_add(1, memory_order_relaxed);
+    }
+
+private:
+    atomic<size_t> *m_counter;
+};
+
+/**
+ * 不继承Command、只提供execute()的命令，带一个短字符串(在string的SSO范围内)。
+ */
+class PayloadCommand : public AllocationCounter
+{
+public:
+    PayloadCommand(atomic<size_t> *counter, const char *pay_load) : m_counter(counter), m_pay_load(pay_load) {}
+    void execute() const
+    {
+        m_counter->fetch_add(m_pay_load.size() > 0, memory_order_relaxed);
+    }
+
+private:
+    atomic<size_t> *m_counter;
+    CountedString m_pay_load;
+};
+
+/**
+ * 超过InlineCommand::kInlineSize的命令，退回到堆上保存。
+ */
+class LargeCommand : public AllocationCounter
+{
+public:
+    explicit LargeCommand(atomic<size_t> *counter) : m_counter(counter), m_data{} {}
+    void execute() const
+    {
+        m_counter->fetch_add(1 + m_data[0], memory_order_relaxed);
+    }
+
+private:
+    atomic<size_t> *m_counter;
+    char m_data[128];
+};
+
+/**
+ * 单个生产者、单个工作线程，比较每条命令的堆分配次数(命令对象及其字符串)和耗时。
+ */
+void benchmarkCommandAllocations(size_t commandCount)
+{
+    cout << "allocations per command, " << commandCount << " commands, 1 producer, 1 worker\n";
+    auto run = [&](const char *name, bool isInline, auto postOne)
+    {
+        atomic<size_t> counter{0};
+        AsyncInvoker invoker(1);
+        size_t before = AllocationCounter::s_allocations;
+        double ms = measureMs([&]
+                              {
+            for (size_t i = 0; i < commandCount; i++)
+            {
+                postOne(invoker, counter);
+            }
+            invoker.shutdown(); });
+        cout << fixed << setprecision(2);
+        cout << "  " << left << setw(36) << name << right << (isInline ? " inline" : "   heap") << setw(7)
+             << (double)(AllocationCounter::s_allocations - before) / commandCount << " allocs/cmd, " << setw(7)
+             << ms * 1e6 / commandCount << " ns/cmd" << (counter.load() == commandCount ? "" : "  (LOST COMMANDS)")
+             << "\n";
+    };
+    run("post(new CountingCommand)", false, [](AsyncInvoker &invoker, atomic<size_t> &counter)
+        { invoker.post(new CountingCommand(&counter)); });
+    run("post<CountingCommand>", InlineCommand::fitsInline<CountingCommand>(),
+        [](AsyncInvoker &invoker, atomic<size_t> &counter)
+        { invoker.post<CountingCommand>(&counter); });
+    run("post<PayloadCommand>", InlineCommand::fitsInline<PayloadCommand>(),
+        [](AsyncInvoker &invoker, atomic<size_t> &counter)
+        { invoker.post<PayloadCommand>(&counter, "Say Hi!"); });
+    run("post<PayloadCommand> (long payload)", InlineCommand::fitsInline<PayloadCommand>(),
+        [](AsyncInvoker &invoker, atomic<size_t> &counter)
+        { invoker.post<PayloadCommand>(&counter, "Say Hi! This payload is too long for the short string buffer."); });
+    run("post<LargeCommand> (over threshold)", InlineCommand::fitsInline<LargeCommand>(),
+        [](AsyncInvoker &invoker, atomic<size_t> &counter)
+        { invoker.post<LargeCommand>(&counter); });
+}
+
+/**
+ * 在临时目录中比较每条命令单独fsync与组提交的持久化吞吐量(命令输出被关闭)。
+ */
+void benchmarkJournal(size_t commandCount)
+{
+    string path = (filesystem::temp_directory_path() / "command_journal_bench.log").string();
+    cout << "CommandJournal: " << commandCount << " durable commands in " << path << "\n";
+    const char *modeNames[] = {"fsync per command", "group commit"};
+    for (CommandJournal::SyncMode mode : {CommandJournal::SYNC_EACH, CommandJournal::GROUP_COMMIT})
+    {
+        for (size_t threadCount : {1, 8, 64})
+        {
+            filesystem::remove(path);
+            Receiver receiver;
+            size_t syncs = 0;
+            atomic<bool> ok{true};
+            cout.setstate(ios::badbit);
+            double ms = measureMs([&]
+                                  {
+                CommandJournal journal(path, mode);
+                vector<thread> threads;
+                for (size_t t = 0; t < threadCount; t++)
+                {
+                    threads.emplace_back([&, t]
+                                         {
+                        for (size_t i = commandCount * t / threadCount; i < commandCount * (t + 1) / threadCount; i++)
+                        {
+                            if (!journal.execute(ComplexCommand(&receiver, "task " + to_string(i), "report")))
+                            {
+                                ok = false;
+                            }
+                        } });
+                }
+                for (thread &th : threads)
+                {
+                    th.join();
+                }
+                syncs = journal.syncCount(); });
+            Receiver recovered;
+            size_t replayed = CommandJournal::replay(path, &recovered);
+            cout.clear();
+            cout << fixed << setprecision(2);
+            cout << "  " << left << setw(18) << modeNames[mode] << right << setw(3) << threadCount << " threads: "
+                 << setw(10) << commandCount / ms * 1000 << " commands/s, " << setw(6) << syncs << " fsyncs"
+                 << (ok && replayed == commandCount && recovered.history() == receiver.history()
+                         ? ""
+                         : "  (REPLAY MISMATCH)")
+                 << "\n";
+        }
+    }
+    filesystem::remove(path);
+}
+
+/**
+ * 做固定量计算的命令，用于组合命令的测试。
+ */
+class BusyCommand : public Command
+{
+public:
+    explicit BusyCommand(uint64_t iterations) : m_iterations(iterations) {}
+    void execute() const override
+    {
+        uint64_t x = m_iterations;
+        for (uint64_t i = 0; i < m_iterations; i++)
+        {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        m_sink = x;
+    }
+
+private:
+    uint64_t m_iterations;
+    mutable uint64_t m_sink = 0;
+};
+
+/**
+ * 宽而浅的命令图：width个互相独立的子命令，每两个汇总成一个，最后一个汇总全部。
+ * 输出实际耗时、总工作量和关键路径，关键路径是多核下耗时的下限。
+ */
+void benchmarkMacroCommand(size_t width)
+{
+    const uint64_t work = 200000;
+    size_t workerCount = std::max(2u, thread::hardware_concurrency());
+    cout << "MacroCommand: " << width << " wide, 3 levels, " << workerCount << " workers, "
+         << thread::hardware_concurrency() << " hardware threads\n";
+    AsyncInvoker pool(workerCount);
+    MacroReport reports[2];
+    for (int parallel = 0; parallel < 2; parallel++)
+    {
+        MacroCommand macro(parallel ? &pool : nullptr);
+        vector<size_t> level1;
+        for (size_t i = 0; i < width; i++)
+        {
+            macro.add(new BusyCommand(work));
+        }
+        for (size_t i = 0; i + 1 < width; i += 2)
+        {
+            level1.push_back(macro.add(new BusyCommand(work), {i, i + 1}));
+        }
+        macro.add(new BusyCommand(work * 4), level1);
+        reports[parallel] = macro.run();
+    }
+    // 线程数超过核数时子命令会被抢占，计时会偏大，所以工作量和关键路径取顺序执行的结果
+    const MacroReport &sequential = reports[0], &pooled = reports[1];
+    cout << fixed << setprecision(2);
+    cout << "  total work " << sequential.m_totalWorkMs << " ms, critical path " << sequential.m_criticalPathMs
+         << " ms, available parallelism " << sequential.m_totalWorkMs / sequential.m_criticalPathMs << "x\n";
+    cout << "  sequential wall " << sequential.m_wallMs << " ms, thread pool wall " << pooled.m_wallMs
+         << " ms, speedup " << sequential.m_wallMs / pooled.m_wallMs << "x\n";
+}
+
+void benchmarkAsyncInvoker(size_t commandCount)
+{
+    size_t workerCount = std::max(2u, thread::hardware_concurrency());
+    cout << "AsyncInvoker: " << commandCount << " commands, " << workerCount << " workers, "
+         << thread::hardware_concurrency() << " hardware threads\n";
+    for (size_t producerCount = 1; producerCount <= 64; producerCount *= 2)
+    {
+        atomic<size_t> counter{0};
+        double ms = measureMs([&]
+                              {
+            AsyncInvoker invoker(workerCount);
+            vector<thread> producers;
+            for (size_t p = 0; p < producerCount; p++)
+            {
+                producers.emplace_back([&, p]
+                                       {
+                    size_t begin = commandCount * p / producerCount, end = commandCount * (p + 1) / producerCount;
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        invoker.post(new CountingCommand(&counter));
+                    } });
+            }
+            for (thread &producer : producers)
+            {
+                producer.join();
+            }
+            invoker.shutdown(); });
+        cout << fixed << setprecision(2);
+        cout << "  " << setw(2) << producerCount << " producers: " << setw(9) << ms << " ms, " << setw(12)
+             << commandCount / ms * 1000 << " commands/s" << (counter.load() == commandCount ? "" : "  (LOST COMMANDS)")
+             << "\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        size_t commandCount = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000;
+        benchmarkAsyncInvoker(commandCount);
+        benchmarkCommandAllocations(commandCount);
+        benchmarkJournal(std::min(commandCount, (size_t)5000));
+        benchmarkMacroCommand(256);
+        return 0;
+    }
+
     clientCode();
+    cout << endl;
+    asyncClientCode();
+    cout << endl;
+    journalClientCode();
+    cout << endl;
+    macroClientCode();
     return 0;
 }
\ No newline at end of file
@@ -1,35 +1,222 @@
 #include <iostream>
 #include <vector>
+#include <numeric>
+#include <algorithm>
+#include <execution>
+#include <chrono>
+#include <string>
+#include <new>
+#include <cstdint>
+#include <climits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <tuple>
+#include <shared_mutex>
+#include <random>
+#include <utility>
+#include <type_traits>
+#include <cstring>
+#include <stdexcept>
+#include <filesystem>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 using namespace std;
 
+/**
+ * 缓存行大小。Container的存储按缓存行对齐，分块遍历时每块的起始地址也按缓存行对齐，便于SIMD对齐加载。
+ */
+const size_t kCacheLineSize = 64;
+
+/**
+ * 按Alignment字节对齐分配内存的分配器。
+ */
+template <typename T, size_t Alignment = kCacheLineSize>
+class AlignedAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() noexcept {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), align_val_t(Alignment)));
+    }
+    void deallocate(T *p, size_t) noexcept
+    {
+        ::operator delete(p, align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const noexcept
+    {
+        return false;
+    }
+};
+
+/**
+ * 一段连续元素的非拥有视图，分块遍历时每次返回一个Span。
+ */
+template <typename T>
+class Span
+{
+public:
+    Span(T *data, size_t size) : m_data(data), m_size(size) {}
+
+    T *data() const
+    {
+        return m_data;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+    T *begin() const
+    {
+        return m_data;
+    }
+    T *end() const
+    {
+        return m_data + m_size;
+    }
+    T &operator[](size_t index) const
+    {
+        return m_data[index];
+    }
+
+private:
+    T *m_data;
+    size_t m_size;
+};
+
+/**
+ * ChunkRange把一段连续存储切成固定长度的块(最后一块可能更短)，用范围for遍历时依次得到Span。
+ */
+template <typename T>
+class ChunkRange
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(T *position, T *end, size_t chunkSize) : m_position(position), m_end(end), m_chunkSize(chunkSize) {}
+
+        Span<T> operator*() const
+        {
+            return Span<T>(m_position, min(m_chunkSize, (size_t)(m_end - m_position)));
+        }
+        iterator &operator++()
+        {
+            m_position += min(m_chunkSize, (size_t)(m_end - m_position));
+            return *this;
+        }
+        bool operator!=(const iterator &other) const
+        {
+            return m_position != other.m_position;
+        }
+
+    private:
+        T *m_position;
+        T *m_end;
+        size_t m_chunkSize;
+    };
+
+    ChunkRange(T *data, size_t size, size_t chunkSize) : m_data(data), m_size(size), m_chunkSize(chunkSize) {}
+
+    iterator begin() const
+    {
+        return iterator(m_data, m_data + m_size, m_chunkSize);
+    }
+    iterator end() const
+    {
+        return iterator(m_data + m_size, m_data + m_size, m_chunkSize);
+    }
+
+private:
+    T *m_data;
+    size_t m_size;
+    size_t m_chunkSize;
+};
+
 /**
  * 目的: 让你遍历一个集合的元素而不暴露它的底层表示(列表，堆栈，树，等等)。
  * c++有自己的迭代器实现，它与标准库定义的不同泛型容器一起工作。
+ * Iterator只依赖集合的iterator类型和begin()/end()，因此同样适用于Container和MappedContainer。
  */
 template <typename T, typename U>
 class Iterator
 {
 public:
-    typedef typename vector<T>::iterator iter_type;
+    typedef typename U::iterator iter_type;
 
-    Iterator(U *p_data, bool reverse = false) : m_p_data(p_data)
+    /**
+     * reverse为true时从最后一个元素向第一个元素遍历。
+     */
+    Iterator(U *p_data, bool reverse = false) : m_p_data(p_data), m_reverse(reverse)
     {
-        m_it = m_p_data->m_data.begin();
+        first();
     }
 
     void first()
     {
-        m_it = m_p_data->m_data.begin();
+        if (m_reverse && m_p_data->begin() != m_p_data->end())
+        {
+            m_it = m_p_data->end() - 1;
+        }
+        else
+        {
+            m_it = m_reverse ? m_p_data->end() : m_p_data->begin();
+        }
     }
 
     void next()
     {
-        m_it++;
+        if (!m_reverse)
+        {
+            m_it++;
+        }
+        else if (m_it == m_p_data->begin())
+        {
+            m_it = m_p_data->end(); // 反向遍历结束，与正向一样以end()表示完成
+        }
+        else
+        {
+            m_it--;
+        }
     }
 
     bool isDone()
     {
-        return (m_it == m_p_data->m_data.end());
+        return (m_it == m_p_data->end());
     }
 
     iter_type current()
@@ -40,79 +227,1713 @@ public:
 private:
     U *m_p_data;
     iter_type m_it;
+    bool m_reverse;
+};
+
+/**
+ * 工作窃取线程池：每个工作线程有自己的任务队列，从队尾取自己的任务(后进先出，缓存友好)，
+ * 自己的队列空了就从其他线程队列的队头窃取任务(先进先出，窃取到的通常是较大的任务)。
+ * 非工作线程提交的任务轮流放入各个队列；等待结果的线程可以调用runPendingTask()帮忙执行任务。
+ */
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(size_t threadCount = thread::hardware_concurrency())
+        : m_stop(false), m_pending(0), m_nextQueue(0)
+    {
+        threadCount = max(threadCount, (size_t)1);
+        for (size_t i = 0; i < threadCount; i++)
+        {
+            m_queues.emplace_back(new WorkQueue);
+        }
+        for (size_t i = 0; i < threadCount; i++)
+        {
+            m_threads.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+    ~WorkStealingPool()
+    {
+        {
+            lock_guard<mutex> lock(m_sleepMutex);
+            m_stop = true;
+        }
+        m_wakeUp.notify_all();
+        for (thread &worker : m_threads)
+        {
+            worker.join();
+        }
+    }
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    size_t size() const
+    {
+        return m_threads.size();
+    }
+
+    void submit(function<void()> task)
+    {
+        size_t index = (t_pool == this) ? t_index : m_nextQueue.fetch_add(1, memory_order_relaxed) % m_queues.size();
+        {
+            // 在m_sleepMutex内增加计数：工作线程检查条件和进入等待之间不会错过这次唤醒。
+            // 计数必须在任务入队之前增加，否则其他线程可能先取走任务，把计数减到0以下(回绕)
+            lock_guard<mutex> lock(m_sleepMutex);
+            m_pending.fetch_add(1, memory_order_release);
+        }
+        {
+            lock_guard<mutex> lock(m_queues[index]->m_mutex);
+            m_queues[index]->m_tasks.push_back(move(task));
+        }
+        m_wakeUp.notify_one();
+    }
+
+    /**
+     * 执行一个待处理的任务(优先自己的队列，其次窃取)，没有任务时返回false。
+     */
+    bool runPendingTask()
+    {
+        function<void()> task;
+        if (!popTask(task))
+        {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+private:
+    struct WorkQueue
+    {
+        mutex m_mutex;
+        deque<function<void()>> m_tasks;
+    };
+
+    bool popTask(function<void()> &task)
+    {
+        size_t count = m_queues.size();
+        size_t self = (t_pool == this) ? t_index : 0;
+        if (t_pool == this)
+        {
+            WorkQueue &own = *m_queues[self];
+            lock_guard<mutex> lock(own.m_mutex);
+            if (!own.m_tasks.empty())
+            {
+                task = move(own.m_tasks.back());
+                own.m_tasks.pop_back();
+                m_pending.fetch_sub(1, memory_order_relaxed);
+                return true;
+            }
+        }
+        for (size_t i = 1; i <= count; i++)
+        {
+            WorkQueue &victim = *m_queues[(self + i) % count];
+            lock_guard<mutex> lock(victim.m_mutex);
+            if (!victim.m_tasks.empty())
+            {
+                task = move(victim.m_tasks.front());
+                victim.m_tasks.pop_front();
+                m_pending.fetch_sub(1, memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t index)
+    {
+        t_pool = this;
+        t_index = index;
+        while (true)
+        {
+            if (runPendingTask())
+            {
+                continue;
+            }
+            unique_lock<mutex> lock(m_sleepMutex);
+            m_wakeUp.wait(lock, [this] { return m_stop || m_pending.load(memory_order_acquire) > 0; });
+            if (m_stop)
+            {
+                return;
+            }
+        }
+    }
+
+    vector<unique_ptr<WorkQueue>> m_queues;
+    vector<thread> m_threads;
+    mutex m_sleepMutex;
+    condition_variable m_wakeUp;
+    bool m_stop;
+    atomic<size_t> m_pending;
+    atomic<size_t> m_nextQueue;
+
+    static thread_local WorkStealingPool *t_pool;
+    static thread_local size_t t_index;
 };
 
+thread_local WorkStealingPool *WorkStealingPool::t_pool = nullptr;
+thread_local size_t WorkStealingPool::t_index = 0;
+
 /**
  * 泛型集合/容器提供一个或几个方法来检索新的迭代器实例，与集合类兼容。
+ * 除了上面的Iterator，Container也提供标准的随机访问迭代器begin()/end()(按值返回)，
+ * 可以直接用于范围for、std::sort、std::reduce以及std::execution::par等并行算法。
  */
 template <class T>
 class Container
 {
-    friend class Iterator<T, Container>;
-
 public:
+    typedef vector<T, AlignedAllocator<T>> storage_type;
+    typedef typename storage_type::iterator iterator;
+    typedef typename storage_type::const_iterator const_iterator;
+    typedef typename storage_type::reverse_iterator reverse_iterator;
+
+    /**
+     * 分块遍历默认每块16KB，能放进L1缓存。
+     */
+    static const size_t kDefaultChunkBytes = 16 * 1024;
+
     void add(T t)
     {
         m_data.push_back(t);
     }
 
-    Iterator<T, Container> *createContainer()
+    Iterator<T, Container> *createContainer(bool reverse = false)
+    {
+        return new Iterator<T, Container>(this, reverse);
+    }
+
+    iterator begin()
+    {
+        return m_data.begin();
+    }
+    iterator end()
+    {
+        return m_data.end();
+    }
+    const_iterator begin() const
+    {
+        return m_data.begin();
+    }
+    const_iterator end() const
+    {
+        return m_data.end();
+    }
+    reverse_iterator rbegin()
+    {
+        return m_data.rbegin();
+    }
+    reverse_iterator rend()
+    {
+        return m_data.rend();
+    }
+
+    size_t size() const
+    {
+        return m_data.size();
+    }
+    void reserve(size_t n)
+    {
+        m_data.reserve(n);
+    }
+    T &operator[](size_t index)
+    {
+        return m_data[index];
+    }
+
+    /**
+     * 分块遍历：每次得到一段连续的Span，消费方可以对整块运行SIMD内核。
+     * 块长度会向上取整，使每块的字节数是缓存行大小的整数倍，因此每块的起始地址都按缓存行对齐。
+     */
+    ChunkRange<T> chunks(size_t chunkBytes = kDefaultChunkBytes)
+    {
+        size_t lineElements = kCacheLineSize / gcd(kCacheLineSize, sizeof(T));
+        size_t chunkSize = max(chunkBytes / sizeof(T), (size_t)1);
+        chunkSize = (chunkSize + lineElements - 1) / lineElements * lineElements;
+        return ChunkRange<T>(m_data.data(), m_data.size(), chunkSize);
+    }
+
+    /**
+     * 并行遍历：把下标区间递归二分，右半部分作为任务交给工作窃取线程池，左半部分继续在当前线程切分，
+     * 直到区间不大于grainSize时顺序执行。每个元素的工作量不均匀时，空闲线程会窃取剩下的大区间，
+     * 不会像静态划分那样让部分核心空等。调用线程也会参与执行，直到所有元素处理完毕。
+     * f抛出的第一个异常会在遍历结束后重新抛出。
+     */
+    template <typename F>
+    void parallelForEach(F f, WorkStealingPool &pool, size_t grainSize = 1024)
     {
-        return new Iterator<T, Container>(this);
+        grainSize = max(grainSize, (size_t)1);
+        atomic<size_t> remaining(m_data.size());
+        exception_ptr error;
+        mutex errorMutex;
+
+        function<void(size_t, size_t)> run = [&](size_t begin, size_t end) {
+            while (end - begin > grainSize)
+            {
+                size_t middle = begin + (end - begin) / 2;
+                pool.submit([&run, middle, end] { run(middle, end); });
+                end = middle;
+            }
+            try
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    f(m_data[i]);
+                }
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(errorMutex);
+                if (!error)
+                {
+                    error = current_exception();
+                }
+            }
+            remaining.fetch_sub(end - begin, memory_order_acq_rel);
+        };
+
+        if (!m_data.empty())
+        {
+            run(0, m_data.size());
+        }
+        while (remaining.load(memory_order_acquire) > 0)
+        {
+            if (!pool.runPendingTask())
+            {
+                this_thread::yield();
+            }
+        }
+        if (error)
+        {
+            rethrow_exception(error);
+        }
     }
 
 private:
-    vector<T> m_data;
+    storage_type m_data;
 };
 
-class Data
+/**
+ * MappedContainer是数据放在内存映射文件中的Container，只支持可平凡复制的T。
+ * 文件开头是一个缓存行大小的文件头(魔数、元素大小、元素个数)，之后是连续存放的元素，
+ * 因此数据可以比内存大：遍历时由操作系统按需换入页面，不需要先整体加载。
+ * 与Container一样支持add、begin()/end()、operator[]和createContainer()，现有的迭代代码可以直接使用。
+ * 容量不足时文件大小翻倍并重新映射，这会使已有的迭代器和指针失效(与vector扩容相同)。
+ */
+template <typename T>
+class MappedContainer
 {
+    static_assert(is_trivially_copyable<T>::value, "MappedContainer requires a trivially copyable T");
+
 public:
-    Data(int a = 0) : m_data(a) {}
-    void setData(int a)
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    /**
+     * 打开或创建path处的文件。文件已存在但格式或元素大小不符时isOpen()返回false。
+     */
+    explicit MappedContainer(const string &path, size_t initialCapacity = 4096)
+        : m_base(nullptr), m_capacity(0)
     {
-        m_data = a;
+#ifdef _WIN32
+        m_mapping = nullptr;
+        m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+        LARGE_INTEGER fileSize;
+        size_t existingBytes = GetFileSizeEx(m_file, &fileSize) ? (size_t)fileSize.QuadPart : 0;
+#else
+        m_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (m_fd < 0)
+        {
+            return;
+        }
+        struct stat st;
+        size_t existingBytes = fstat(m_fd, &st) == 0 ? (size_t)st.st_size : 0;
+#endif
+        if (existingBytes < kHeaderSize)
+        {
+            if (!map(max(initialCapacity, (size_t)1)))
+            {
+                return;
+            }
+            memcpy(header().m_magic, kMagic, sizeof(kMagic));
+            header().m_elementSize = sizeof(T);
+            header().m_count = 0;
+        }
+        else if (!map((existingBytes - kHeaderSize) / sizeof(T)) ||
+                 memcmp(header().m_magic, kMagic, sizeof(kMagic)) != 0 ||
+                 header().m_elementSize != sizeof(T) || header().m_count > m_capacity)
+        {
+            unmap();
+        }
     }
-    int data()
+    ~MappedContainer()
     {
-        return m_data;
+        unmap();
+#ifdef _WIN32
+        if (m_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_file);
+        }
+#else
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+#endif
+    }
+    MappedContainer(const MappedContainer &) = delete;
+    MappedContainer &operator=(const MappedContainer &) = delete;
+
+    bool isOpen() const
+    {
+        return m_base != nullptr;
+    }
+
+    /**
+     * 追加一个元素，容量不足时翻倍并重新映射。文件没有打开时抛出logic_error，重新映射失败时抛出bad_alloc。
+     */
+    void add(const T &t)
+    {
+        if (!isOpen())
+        {
+            throw logic_error("MappedContainer: add on a container that is not open");
+        }
+        size_t count = header().m_count;
+        // 重新打开的文件可能正好容量为0
+        if (count == m_capacity && !map(max(m_capacity * 2, (size_t)1)))
+        {
+            throw bad_alloc();
+        }
+        memcpy(data() + count, &t, sizeof(T));
+        header().m_count = count + 1;
+    }
+
+    Iterator<T, MappedContainer> *createContainer(bool reverse = false)
+    {
+        return new Iterator<T, MappedContainer>(this, reverse);
+    }
+
+    iterator begin()
+    {
+        return data();
+    }
+    iterator end()
+    {
+        return data() + size();
+    }
+    const_iterator begin() const
+    {
+        return data();
+    }
+    const_iterator end() const
+    {
+        return data() + size();
+    }
+
+    size_t size() const
+    {
+        return m_base ? header().m_count : 0;
+    }
+    T &operator[](size_t index)
+    {
+        return data()[index];
+    }
+
+    /**
+     * 提示操作系统接下来会顺序扫描整个数据，使其加大预读并尽早回收已读过的页面。
+     */
+    void adviseSequential()
+    {
+#ifndef _WIN32
+        if (m_base)
+        {
+            madvise(m_base, mappedBytes(), MADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+    /**
+     * 提示操作系统在后台预读[first, first + count)范围内的元素，扫描到这里之前就把页面读入内存。
+     */
+    void prefetch(size_t first, size_t count)
+    {
+        if (m_base == nullptr || first >= size())
+        {
+            return;
+        }
+        count = min(count, size() - first);
+        uintptr_t begin = reinterpret_cast<uintptr_t>(data() + first) / pageSize() * pageSize();
+        uintptr_t end = reinterpret_cast<uintptr_t>(data() + first + count);
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range{reinterpret_cast<void *>(begin), end - begin};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+#endif
+    }
+
+    /**
+     * 把修改过的页面写回文件。
+     */
+    void flush()
+    {
+        if (m_base)
+        {
+#ifdef _WIN32
+            FlushViewOfFile(m_base, 0);
+#else
+            msync(m_base, mappedBytes(), MS_SYNC);
+#endif
+        }
     }
 
 private:
-    int m_data;
+    struct Header
+    {
+        char m_magic[4];
+        uint32_t m_elementSize;
+        uint64_t m_count;
+    };
+    static constexpr size_t kHeaderSize = kCacheLineSize;
+    static constexpr char kMagic[4] = {'M', 'C', 'O', 'N'};
+
+    Header &header()
+    {
+        return *reinterpret_cast<Header *>(m_base);
+    }
+    const Header &header() const
+    {
+        return *reinterpret_cast<const Header *>(m_base);
+    }
+    T *data()
+    {
+        return reinterpret_cast<T *>(m_base + kHeaderSize);
+    }
+    const T *data() const
+    {
+        return reinterpret_cast<const T *>(m_base + kHeaderSize);
+    }
+    size_t mappedBytes() const
+    {
+        return kHeaderSize + m_capacity * sizeof(T);
+    }
+
+    /**
+     * 系统的页面大小，第一次调用时查询一次。
+     */
+    static uintptr_t pageSize()
+    {
+#ifdef _WIN32
+        static const uintptr_t size = [] {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return (uintptr_t)info.dwPageSize;
+        }();
+#else
+        static const uintptr_t size = (uintptr_t)sysconf(_SC_PAGESIZE);
+#endif
+        return size;
+    }
+
+    /**
+     * 把文件扩展到能容纳capacity个元素并(重新)映射。
+     */
+    bool map(size_t capacity)
+    {
+        unmap();
+        size_t bytes = kHeaderSize + capacity * sizeof(T);
+#ifdef _WIN32
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)bytes >> 32),
+                                       (DWORD)(bytes & 0xffffffff), nullptr);
+        if (m_mapping == nullptr)
+        {
+            return false;
+        }
+        m_base = static_cast<char *>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes));
+#else
+        struct stat st;
+        if (fstat(m_fd, &st) != 0 || ((size_t)st.st_size < bytes && ftruncate(m_fd, bytes) != 0))
+        {
+            return false;
+        }
+        void *base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        m_base = base == MAP_FAILED ? nullptr : static_cast<char *>(base);
+#endif
+        m_capacity = m_base ? capacity : 0;
+        return m_base != nullptr;
+    }
+
+    void unmap()
+    {
+#ifdef _WIN32
+        if (m_base)
+        {
+            UnmapViewOfFile(m_base);
+        }
+        if (m_mapping)
+        {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+        }
+#else
+        if (m_base)
+        {
+            munmap(m_base, mappedBytes());
+        }
+#endif
+        m_base = nullptr;
+        m_capacity = 0;
+    }
+
+    char *m_base;
+    size_t m_capacity;
+#ifdef _WIN32
+    HANDLE m_file;
+    HANDLE m_mapping;
+#else
+    int m_fd;
+#endif
 };
 
-void clientCode()
+/**
+ * ConcurrentContainer支持一边追加一边遍历：读者无锁地遍历一个稳定的快照，写者同时追加。
+ * 存储分段：第k段容纳kFirstSegmentSize * 2^k个元素，段一旦分配就不再移动，
+ * 所以追加永远不会像vector扩容那样让正在遍历的读者失效，也就不需要延迟回收(epoch)旧存储，段在容器析构时才释放。
+ * 写者之间用互斥锁串行化；元素构造完成后才以release语义发布新的size，读者以acquire语义读取size得到快照。
+ */
+template <typename T>
+class ConcurrentContainer
 {
-    Container<int> cont;
-    for (int i = 0; i < 10; i++)
+public:
+    static const size_t kFirstSegmentSize = 64;
+    static const size_t kMaxSegments = 48;
+
+    /**
+     * 快照只包含创建时已经发布的元素，之后的追加对它不可见。
+     */
+    class Snapshot
     {
-        cont.add(i);
+    public:
+        class iterator
+        {
+        public:
+            typedef forward_iterator_tag iterator_category;
+            typedef T value_type;
+            typedef ptrdiff_t difference_type;
+            typedef const T *pointer;
+            typedef const T &reference;
+
+            iterator(const ConcurrentContainer *container, size_t index) : m_container(container), m_index(index)
+            {
+                locate();
+            }
+
+            const T &operator*() const
+            {
+                return *m_current;
+            }
+            const T *operator->() const
+            {
+                return m_current;
+            }
+            iterator &operator++()
+            {
+                m_index++;
+                if (++m_current == m_segmentEnd)
+                {
+                    locate();
+                }
+                return *this;
+            }
+            bool operator==(const iterator &other) const
+            {
+                return m_index == other.m_index;
+            }
+            bool operator!=(const iterator &other) const
+            {
+                return m_index != other.m_index;
+            }
+
+        private:
+            void locate()
+            {
+                size_t segment = segmentOf(m_index);
+                const T *base = m_container->m_segments[segment].load(memory_order_acquire);
+                m_current = base ? base + (m_index - segmentStart(segment)) : nullptr;
+                m_segmentEnd = base ? base + segmentSize(segment) : nullptr;
+            }
+
+            const ConcurrentContainer *m_container;
+            size_t m_index;
+            const T *m_current;
+            const T *m_segmentEnd;
+        };
+
+        Snapshot(const ConcurrentContainer *container, size_t size) : m_container(container), m_size(size) {}
+
+        size_t size() const
+        {
+            return m_size;
+        }
+        const T &operator[](size_t index) const
+        {
+            return m_container->at(index);
+        }
+        iterator begin() const
+        {
+            return iterator(m_container, 0);
+        }
+        iterator end() const
+        {
+            return iterator(m_container, m_size);
+        }
+
+    private:
+        const ConcurrentContainer *m_container;
+        size_t m_size;
+    };
+
+    ConcurrentContainer() : m_size(0)
+    {
+        for (size_t i = 0; i < kMaxSegments; i++)
+        {
+            m_segments[i].store(nullptr, memory_order_relaxed);
+        }
+    }
+    ~ConcurrentContainer()
+    {
+        size_t size = m_size.load(memory_order_relaxed);
+        for (size_t i = 0; i < size; i++)
+        {
+            const_cast<T &>(at(i)).~T();
+        }
+        for (size_t i = 0; i < kMaxSegments; i++)
+        {
+            if (T *segment = m_segments[i].load(memory_order_relaxed))
+            {
+                ::operator delete(segment, align_val_t(alignof(T)));
+            }
+        }
     }
+    ConcurrentContainer(const ConcurrentContainer &) = delete;
+    ConcurrentContainer &operator=(const ConcurrentContainer &) = delete;
 
-    Iterator<int, Container<int>> *it = cont.createContainer();
-    for (it->first(); !it->isDone(); it->next())
+    void add(T t)
     {
-        cout << *it->current() << endl;
+        lock_guard<mutex> lock(m_writeMutex);
+        size_t index = m_size.load(memory_order_relaxed);
+        size_t segment = segmentOf(index);
+        T *base = m_segments[segment].load(memory_order_relaxed);
+        if (base == nullptr)
+        {
+            base = static_cast<T *>(::operator new(segmentSize(segment) * sizeof(T), align_val_t(alignof(T))));
+            m_segments[segment].store(base, memory_order_release);
+        }
+        new (base + (index - segmentStart(segment))) T(move(t));
+        m_size.store(index + 1, memory_order_release);
     }
 
-    Container<Data> cont2;
-    Data a(100), b(200), c(3000);
-    cont2.add(a);
-    cont2.add(b);
-    cont2.add(c);
+    Snapshot snapshot() const
+    {
+        return Snapshot(this, m_size.load(memory_order_acquire));
+    }
 
-    Iterator<Data, Container<Data>> *it2 = cont2.createContainer();
-    for (it2->first(); !it2->isDone(); it2->next())
+    size_t size() const
     {
-        cout << it2->current()->data() << endl;
+        return m_size.load(memory_order_acquire);
     }
 
-    delete it, it2;
-}
+private:
+    /**
+     * 第k段从kFirstSegmentSize * (2^k - 1)开始。
+     */
+    static size_t segmentOf(size_t index)
+    {
+        size_t block = index / kFirstSegmentSize + 1;
+        size_t segment = 0;
+        while (block >>= 1)
+        {
+            segment++;
+        }
+        return segment;
+    }
+    static size_t segmentStart(size_t segment)
+    {
+        return kFirstSegmentSize * ((size_t(1) << segment) - 1);
+    }
+    static size_t segmentSize(size_t segment)
+    {
+        return kFirstSegmentSize << segment;
+    }
+
+    const T &at(size_t index) const
+    {
+        size_t segment = segmentOf(index);
+        return m_segments[segment].load(memory_order_acquire)[index - segmentStart(segment)];
+    }
+
+    atomic<T *> m_segments[kMaxSegments];
+    atomic<size_t> m_size;
+    mutex m_writeMutex;
+};
 
-int main(void)
+/**
+ * 列式存储需要知道记录由哪些字段组成。为记录类型特化ColumnTraits，提供：
+ *   typedef tuple<字段类型...> columns;
+ *   static columns split(const Record &record);   // 记录 -> 各字段
+ *   static Record join(const columns &fields);    // 各字段 -> 记录
+ */
+template <typename Record>
+struct ColumnTraits;
+
+template <typename Columns>
+struct ColumnStorage;
+
+template <typename... Ts>
+struct ColumnStorage<tuple<Ts...>>
+{
+    typedef tuple<vector<Ts, AlignedAllocator<Ts>>...> type;
+};
+
+/**
+ * ColumnarContainer是Container的列式(结构体数组，SoA)版本：记录的每个字段各自存放在一段连续、按缓存行对齐的列中。
+ * 只读取单个字段的扫描用column<I>()，只会把这一列读进缓存；
+ * 也可以像Container一样用范围for或createContainer()逐条遍历记录，每次得到一个由各列拼出来的Record值。
+ * 记录不是连续存放的，迭代器的operator->返回一个持有拼好的Record的代理对象，所以it->current()->data()仍然可用。
+ */
+template <typename Record>
+class ColumnarContainer
 {
+public:
+    typedef ColumnTraits<Record> traits;
+    typedef typename traits::columns columns;
+    static const size_t kColumnCount = tuple_size<columns>::value;
+
+    class iterator
+    {
+    public:
+        /**
+         * operator->的返回值：保存一个拼好的Record，在整个表达式结束前有效。
+         */
+        class pointer
+        {
+        public:
+            explicit pointer(Record record) : m_record(std::move(record)) {}
+            const Record *operator->() const
+            {
+                return &m_record;
+            }
+
+        private:
+            Record m_record;
+        };
+
+        typedef bidirectional_iterator_tag iterator_category;
+        typedef Record value_type;
+        typedef ptrdiff_t difference_type;
+        typedef Record reference;
+
+        iterator() : m_container(nullptr), m_index(0) {}
+        iterator(const ColumnarContainer *container, size_t index) : m_container(container), m_index(index) {}
+
+        Record operator*() const
+        {
+            return (*m_container)[m_index];
+        }
+        pointer operator->() const
+        {
+            return pointer((*m_container)[m_index]);
+        }
+        iterator &operator++()
+        {
+            m_index++;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator old = *this;
+            m_index++;
+            return old;
+        }
+        iterator &operator--()
+        {
+            m_index--;
+            return *this;
+        }
+        iterator operator--(int)
+        {
+            iterator old = *this;
+            m_index--;
+            return old;
+        }
+        // Iterator::first()反向遍历时用end() - 1定位最后一个元素
+        iterator operator-(difference_type n) const
+        {
+            return iterator(m_container, m_index - n);
+        }
+        bool operator==(const iterator &other) const
+        {
+            return m_index == other.m_index;
+        }
+        bool operator!=(const iterator &other) const
+        {
+            return m_index != other.m_index;
+        }
+
+    private:
+        const ColumnarContainer *m_container;
+        size_t m_index;
+    };
+
+    void add(const Record &record)
+    {
+        pushFields(traits::split(record), make_index_sequence<kColumnCount>());
+    }
+
+    size_t size() const
+    {
+        return get<0>(m_columns).size();
+    }
+    void reserve(size_t n)
+    {
+        apply([n](auto &...column) { (column.reserve(n), ...); }, m_columns);
+    }
+
+    /**
+     * 把第index条记录的各个字段重新拼成一个Record。
+     */
+    Record operator[](size_t index) const
+    {
+        return gatherRecord(index, make_index_sequence<kColumnCount>());
+    }
+
+    iterator begin() const
+    {
+        return iterator(this, 0);
+    }
+    iterator end() const
+    {
+        return iterator(this, size());
+    }
+
+    Iterator<Record, ColumnarContainer> *createContainer(bool reverse = false)
+    {
+        return new Iterator<Record, ColumnarContainer>(this, reverse);
+    }
+
+    /**
+     * 第I个字段的整列数据。
+     */
+    template <size_t I>
+    Span<tuple_element_t<I, columns>> column()
+    {
+        auto &data = get<I>(m_columns);
+        return Span<tuple_element_t<I, columns>>(data.data(), data.size());
+    }
+
+private:
+    template <size_t... I>
+    void pushFields(const columns &fields, index_sequence<I...>)
+    {
+        (get<I>(m_columns).push_back(get<I>(fields)), ...);
+    }
+
+    template <size_t... I>
+    Record gatherRecord(size_t index, index_sequence<I...>) const
+    {
+        return traits::join(columns(get<I>(m_columns)[index]...));
+    }
+
+    typename ColumnStorage<columns>::type m_columns;
+};
+
+class Data
+{
+public:
+    Data(int a = 0) : m_data(a) {}
+    void setData(int a)
+    {
+        m_data = a;
+    }
+    int data() const
+    {
+        return m_data;
+    }
+
+private:
+    int m_data;
+};
+
+template <>
+struct ColumnTraits<Data>
+{
+    typedef tuple<int> columns;
+
+    static columns split(const Data &data)
+    {
+        return columns(data.data());
+    }
+    static Data join(const columns &fields)
+    {
+        return Data(get<0>(fields));
+    }
+};
+
+/**
+ * 惰性范围适配器。filter、transform、take、zip只包装迭代器，不生成中间容器；
+ * 串联起来的流水线在最终遍历时一次完成，每个元素只经过所有阶段一次。
+ * 适配器按值保存谓词/函数，被包装的容器必须比视图活得更久。
+ */
+template <typename It, typename Predicate>
+class FilterIterator
+{
+public:
+    FilterIterator(It current, It end, Predicate predicate) : m_current(current), m_end(end), m_predicate(predicate)
+    {
+        skip();
+    }
+
+    decltype(auto) operator*() const
+    {
+        return *m_current;
+    }
+    FilterIterator &operator++()
+    {
+        ++m_current;
+        skip();
+        return *this;
+    }
+    bool operator==(const FilterIterator &other) const
+    {
+        return m_current == other.m_current;
+    }
+    bool operator!=(const FilterIterator &other) const
+    {
+        return m_current != other.m_current;
+    }
+
+private:
+    void skip()
+    {
+        while (m_current != m_end && !m_predicate(*m_current))
+        {
+            ++m_current;
+        }
+    }
+
+    It m_current;
+    It m_end;
+    Predicate m_predicate;
+};
+
+template <typename It, typename Function>
+class TransformIterator
+{
+public:
+    TransformIterator(It current, Function function) : m_current(current), m_function(function) {}
+
+    decltype(auto) operator*() const
+    {
+        return m_function(*m_current);
+    }
+    TransformIterator &operator++()
+    {
+        ++m_current;
+        return *this;
+    }
+    bool operator==(const TransformIterator &other) const
+    {
+        return m_current == other.m_current;
+    }
+    bool operator!=(const TransformIterator &other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    It m_current;
+    Function m_function;
+};
+
+/**
+ * 取剩余个数为0或到达底层末尾时结束。
+ */
+template <typename It>
+class TakeIterator
+{
+public:
+    TakeIterator(It current, size_t remaining) : m_current(current), m_remaining(remaining) {}
+
+    decltype(auto) operator*() const
+    {
+        return *m_current;
+    }
+    TakeIterator &operator++()
+    {
+        ++m_current;
+        --m_remaining;
+        return *this;
+    }
+    bool operator==(const TakeIterator &other) const
+    {
+        return m_current == other.m_current || m_remaining == other.m_remaining;
+    }
+    bool operator!=(const TakeIterator &other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    It m_current;
+    size_t m_remaining;
+};
+
+/**
+ * 两个范围按位置配对，较短的范围结束时结束。解引用得到两个元素组成的pair。
+ */
+template <typename It1, typename It2>
+class ZipIterator
+{
+public:
+    ZipIterator(It1 first, It2 second) : m_first(first), m_second(second) {}
+
+    auto operator*() const
+    {
+        return pair<decltype(*m_first), decltype(*m_second)>(*m_first, *m_second);
+    }
+    ZipIterator &operator++()
+    {
+        ++m_first;
+        ++m_second;
+        return *this;
+    }
+    bool operator==(const ZipIterator &other) const
+    {
+        return m_first == other.m_first || m_second == other.m_second;
+    }
+    bool operator!=(const ZipIterator &other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    It1 m_first;
+    It2 m_second;
+};
+
+/**
+ * View是一对迭代器，提供链式调用的适配器：view(cont).filter(p).transform(f).take(n)
+ */
+template <typename It>
+class View
+{
+public:
+    View(It begin, It end) : m_begin(begin), m_end(end) {}
+
+    It begin() const
+    {
+        return m_begin;
+    }
+    It end() const
+    {
+        return m_end;
+    }
+
+    template <typename Predicate>
+    View<FilterIterator<It, Predicate>> filter(Predicate predicate) const
+    {
+        typedef FilterIterator<It, Predicate> Filtered;
+        return View<Filtered>(Filtered(m_begin, m_end, predicate), Filtered(m_end, m_end, predicate));
+    }
+
+    template <typename Function>
+    View<TransformIterator<It, Function>> transform(Function function) const
+    {
+        typedef TransformIterator<It, Function> Transformed;
+        return View<Transformed>(Transformed(m_begin, function), Transformed(m_end, function));
+    }
+
+    View<TakeIterator<It>> take(size_t count) const
+    {
+        return View<TakeIterator<It>>(TakeIterator<It>(m_begin, count), TakeIterator<It>(m_end, 0));
+    }
+
+    template <typename Range>
+    auto zip(Range &other) const
+    {
+        typedef ZipIterator<It, decltype(other.begin())> Zipped;
+        return View<Zipped>(Zipped(m_begin, other.begin()), Zipped(m_end, other.end()));
+    }
+
+private:
+    It m_begin;
+    It m_end;
+};
+
+template <typename Range>
+auto view(Range &range)
+{
+    return View<decltype(range.begin())>(range.begin(), range.end());
+}
+
+void clientCode()
+{
+    Container<int> cont;
+    for (int i = 0; i < 10; i++)
+    {
+        cont.add(i);
+    }
+
+    Iterator<int, Container<int>> *it = cont.createContainer();
+    for (it->first(); !it->isDone(); it->next())
+    {
+        cout << *it->current() << endl;
+    }
+
+    Container<Data> cont2;
+    Data a(100), b(200), c(3000);
+    cont2.add(a);
+    cont2.add(b);
+    cont2.add(c);
+
+    Iterator<Data, Container<Data>> *it2 = cont2.createContainer();
+    for (it2->first(); !it2->isDone(); it2->next())
+    {
+        cout << it2->current()->data() << endl;
+    }
+
+    Iterator<int, Container<int>> *reverseIt = cont.createContainer(true);
+    for (reverseIt->first(); !reverseIt->isDone(); reverseIt->next())
+    {
+        cout << *reverseIt->current() << " ";
+    }
+    cout << endl;
+
+    // 标准迭代器可以直接用于标准算法
+    sort(cont.begin(), cont.end(), greater<int>());
+    for (int value : cont)
+    {
+        cout << value << " ";
+    }
+    cout << endl;
+    cout << "sum: " << reduce(cont.begin(), cont.end(), 0) << endl;
+
+    WorkStealingPool pool(4);
+    cont.parallelForEach([](int &value) { value *= 10; }, pool, 2);
+    cout << "after parallelForEach: " << accumulate(cont.begin(), cont.end(), 0) << endl;
+
+    ColumnarContainer<Data> columnar;
+    columnar.add(a);
+    columnar.add(b);
+    columnar.add(c);
+    for (Data data : columnar)
+    {
+        cout << data.data() << " ";
+    }
+    cout << "(column sum " << accumulate(columnar.column<0>().begin(), columnar.column<0>().end(), 0) << ")" << endl;
+    Iterator<Data, ColumnarContainer<Data>> *columnarIt = columnar.createContainer(true);
+    for (columnarIt->first(); !columnarIt->isDone(); columnarIt->next())
+    {
+        cout << columnarIt->current()->data() << " ";
+    }
+    cout << "(columnar, reversed)" << endl;
+    delete columnarIt;
+
+    // 惰性流水线：能被20整除 -> 乘以3 -> 取前3个，再与cont2按位置配对
+    auto pipeline = view(cont)
+                        .filter([](int value) { return value % 20 == 0; })
+                        .transform([](int value) { return value * 3; })
+                        .take(3);
+    for (auto zipped : pipeline.zip(cont2))
+    {
+        cout << "(" << zipped.first << ", " << zipped.second.data() << ") ";
+    }
+    cout << endl;
+
+    // 数据放在内存映射文件中，重新打开后仍然可以用同样的Iterator遍历
+    string mappedPath = (filesystem::temp_directory_path() / "container.mapped").string();
+    {
+        MappedContainer<Data> mapped(mappedPath);
+        mapped.add(a);
+        mapped.add(b);
+        mapped.add(c);
+    }
+    {
+        MappedContainer<Data> mapped(mappedPath);
+        mapped.adviseSequential();
+        Iterator<Data, MappedContainer<Data>> *mappedIt = mapped.createContainer();
+        for (mappedIt->first(); !mappedIt->isDone(); mappedIt->next())
+        {
+            cout << mappedIt->current()->data() << " ";
+        }
+        cout << "(from " << mappedPath << ")" << endl;
+        delete mappedIt;
+    }
+    filesystem::remove(mappedPath);
+
+    // 一边追加一边遍历快照：单个写者按顺序追加0, 1, 2...，所以每个快照都应该恰好是0..size-1
+    ConcurrentContainer<int> concurrent;
+    thread writer([&concurrent] {
+        for (int i = 0; i < 100000; i++)
+        {
+            concurrent.add(i);
+        }
+    });
+    bool snapshotsConsistent = true;
+    for (int round = 0; round < 100; round++)
+    {
+        ConcurrentContainer<int>::Snapshot snapshot = concurrent.snapshot();
+        int expected = 0;
+        for (int value : snapshot)
+        {
+            snapshotsConsistent = snapshotsConsistent && value == expected++;
+        }
+        snapshotsConsistent = snapshotsConsistent && (size_t)expected == snapshot.size();
+    }
+    writer.join();
+    cout << "snapshots consistent: " << snapshotsConsistent << ", final size " << concurrent.size() << endl;
+
+    // 请求每块4个int，块长度会向上取整到一个缓存行(16个int)，所以40个元素分成16 + 16 + 8三块
+    Container<int> chunked;
+    for (int i = 0; i < 40; i++)
+    {
+        chunked.add(i);
+    }
+    for (Span<int> chunk : chunked.chunks(4 * sizeof(int)))
+    {
+        cout << "chunk [" << chunk[0] << ", " << chunk[0] + (int)chunk.size() << ") of " << chunk.size()
+             << " ints, cache-line aligned: " << (reinterpret_cast<uintptr_t>(chunk.data()) % kCacheLineSize == 0)
+             << endl;
+    }
+
+    delete it;
+    delete it2;
+    delete reverseIt;
+}
+
+/**
+ * 以下为性能测试代码，通过 `--bench [元素个数]` 参数运行。
+ */
+template <typename F>
+double measureMs(F &&f)
+{
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void benchmarkIteration(size_t n)
+{
+    Container<int> cont;
+    cont.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        cont.add((int)(i & 0xff));
+    }
+
+    long long sum = 0;
+    double oldMs = measureMs([&] {
+        Iterator<int, Container<int>> *it = cont.createContainer();
+        for (it->first(); !it->isDone(); it->next())
+        {
+            sum += *it->current();
+        }
+        delete it;
+    });
+    cout << "sum of " << n << " ints\n";
+    cout << "  Iterator first/next/isDone: " << oldMs << " ms (" << sum << ")\n";
+
+    sum = 0;
+    double rangeMs = measureMs([&] {
+        for (int value : cont)
+        {
+            sum += value;
+        }
+    });
+    cout << "  range-for begin()/end():    " << rangeMs << " ms (" << sum << ")\n";
+
+    double seqMs = measureMs([&] {
+        sum = reduce(cont.begin(), cont.end(), 0LL);
+    });
+    cout << "  std::reduce:                " << seqMs << " ms (" << sum << ")\n";
+
+#if defined(USE_PARALLEL_STL) && defined(__cpp_lib_parallel_algorithm)
+    // libstdc++的并行算法由TBB实现，需要 -DUSE_PARALLEL_STL -ltbb 编译
+    double parMs = measureMs([&] {
+        sum = reduce(execution::par_unseq, cont.begin(), cont.end(), 0LL);
+    });
+    cout << "  std::reduce par_unseq:      " << parMs << " ms (" << sum << ")\n";
+#else
+    cout << "  std::reduce par_unseq:      skipped (build with -DUSE_PARALLEL_STL -ltbb)\n";
+#endif
+}
+
+/**
+ * 对一块连续的int计算和、最小值、最大值。编译时启用AVX2(-mavx2)则使用256位向量指令，否则使用标量循环。
+ * 分块遍历保证data按缓存行对齐，所以可以使用对齐加载。
+ */
+struct SumMinMax
+{
+    long long m_sum = 0;
+    int m_min = INT_MAX;
+    int m_max = INT_MIN;
+};
+
+void accumulateChunk(Span<const int> chunk, SumMinMax &result)
+{
+    const int *data = chunk.data();
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i sumLow = _mm256_setzero_si256(), sumHigh = _mm256_setzero_si256();
+    __m256i minV = _mm256_set1_epi32(result.m_min), maxV = _mm256_set1_epi32(result.m_max);
+    for (; i + 8 <= chunk.size(); i += 8)
+    {
+        __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i *>(data + i));
+        sumLow = _mm256_add_epi64(sumLow, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        sumHigh = _mm256_add_epi64(sumHigh, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+        minV = _mm256_min_epi32(minV, v);
+        maxV = _mm256_max_epi32(maxV, v);
+    }
+    alignas(32) long long sums[4];
+    alignas(32) int mins[8], maxs[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(sums), _mm256_add_epi64(sumLow, sumHigh));
+    _mm256_store_si256(reinterpret_cast<__m256i *>(mins), minV);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(maxs), maxV);
+    result.m_sum += sums[0] + sums[1] + sums[2] + sums[3];
+    result.m_min = *min_element(mins, mins + 8);
+    result.m_max = *max_element(maxs, maxs + 8);
+#endif
+    for (; i < chunk.size(); i++)
+    {
+        result.m_sum += data[i];
+        result.m_min = min(result.m_min, data[i]);
+        result.m_max = max(result.m_max, data[i]);
+    }
+}
+
+void benchmarkChunkedIteration(size_t n)
+{
+    Container<int> cont;
+    cont.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        cont.add((int)((i * 2654435761u) % 100000) - 50000);
+    }
+
+    SumMinMax oldResult;
+    double oldMs = measureMs([&] {
+        Iterator<int, Container<int>> *it = cont.createContainer();
+        for (it->first(); !it->isDone(); it->next())
+        {
+            oldResult.m_sum += *it->current();
+            oldResult.m_min = min(oldResult.m_min, *it->current());
+            oldResult.m_max = max(oldResult.m_max, *it->current());
+        }
+        delete it;
+    });
+
+    SumMinMax chunkResult;
+    double chunkMs = measureMs([&] {
+        for (Span<int> chunk : cont.chunks())
+        {
+            accumulateChunk(Span<const int>(chunk.data(), chunk.size()), chunkResult);
+        }
+    });
+
+#ifdef __AVX2__
+    const char *kernel = "AVX2";
+#else
+    const char *kernel = "scalar";
+#endif
+    cout << "sum/min/max of " << n << " ints\n";
+    cout << "  Iterator element-at-a-time: " << oldMs << " ms (" << oldResult.m_sum << ", "
+         << oldResult.m_min << ", " << oldResult.m_max << ")\n";
+    cout << "  chunks() + " << kernel << " kernel: " << chunkMs << " ms (" << chunkResult.m_sum << ", "
+         << chunkResult.m_min << ", " << chunkResult.m_max << ")\n";
+}
+
+/**
+ * 模拟每个元素的工作量：cost次整数运算，结果写回元素避免被优化掉。
+ */
+void simulateWork(Data &data, int cost)
+{
+    unsigned x = (unsigned)data.data();
+    for (int i = 0; i < cost; i++)
+    {
+        x = x * 1664525u + 1013904223u;
+    }
+    data.setData((int)(x & 0xffff));
+}
+
+/**
+ * 均匀负载和倾斜负载(最后1/8的元素工作量是其他元素的50倍)下，静态划分与工作窃取的扩展性对比。
+ */
+void benchmarkParallelForEach(size_t n)
+{
+    n = min(n, (size_t)2000000);
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    for (int skewed = 0; skewed <= 1; skewed++)
+    {
+        Container<Data> cont;
+        cont.reserve(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            cont.add(Data((int)i));
+        }
+        auto costOf = [&](Data &data) {
+            return (skewed && (size_t)data.data() >= n - n / 8) ? 2000 : 40;
+        };
+
+        cout << (skewed ? "skewed" : "uniform") << " workload, " << n << " Data records\n";
+        for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            for (size_t i = 0; i < n; i++)
+                cont[i].setData((int)i);
+            double staticMs = measureMs([&] {
+                vector<thread> workers;
+                for (unsigned t = 0; t < threads; t++)
+                {
+                    workers.emplace_back([&, t] {
+                        for (size_t i = n * t / threads; i < n * (t + 1) / threads; i++)
+                            simulateWork(cont[i], costOf(cont[i]));
+                    });
+                }
+                for (thread &worker : workers)
+                    worker.join();
+            });
+
+            for (size_t i = 0; i < n; i++)
+                cont[i].setData((int)i);
+            double stealingMs;
+            if (threads == 1)
+            {
+                // 只有一个线程时没有可以窃取的对象，直接在调用线程顺序执行
+                stealingMs = measureMs([&] {
+                    for (size_t i = 0; i < n; i++)
+                        simulateWork(cont[i], costOf(cont[i]));
+                });
+            }
+            else
+            {
+                WorkStealingPool pool(threads - 1); // 调用线程也参与执行
+                stealingMs = measureMs([&] {
+                    cont.parallelForEach([&](Data &data) { simulateWork(data, costOf(data)); }, pool, 256);
+                });
+            }
+
+            cout << "  " << threads << " threads: static partition " << staticMs << " ms, work stealing "
+                 << stealingMs << " ms\n";
+        }
+    }
+}
+
+/**
+ * 列式存储对比用的较宽的记录(24字节)，扫描时只读取其中的m_price。
+ */
+struct Trade
+{
+    long long m_timestamp;
+    int m_id;
+    float m_price;
+    float m_quantity;
+    int m_flags;
+};
+
+template <>
+struct ColumnTraits<Trade>
+{
+    typedef tuple<long long, int, float, float, int> columns;
+
+    static columns split(const Trade &trade)
+    {
+        return columns(trade.m_timestamp, trade.m_id, trade.m_price, trade.m_quantity, trade.m_flags);
+    }
+    static Trade join(const columns &fields)
+    {
+        return Trade{get<0>(fields), get<1>(fields), get<2>(fields), get<3>(fields), get<4>(fields)};
+    }
+};
+
+void benchmarkColumnarScan(size_t n)
+{
+    n = min(n, (size_t)10000000);
+    Container<Trade> rows;
+    ColumnarContainer<Trade> columns;
+    rows.reserve(n);
+    columns.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        Trade trade{(long long)i, (int)i, (float)(i % 1000) * 0.5f, 1.f, 0};
+        rows.add(trade);
+        columns.add(trade);
+    }
+
+    // 统计价格超过阈值的记录数，整数计数不形成浮点加法依赖链，扫描受内存带宽限制
+    size_t aosCount = 0, soaCount = 0;
+    double aosMs = measureMs([&] {
+        for (const Trade &trade : rows)
+            aosCount += trade.m_price > 250.f;
+    });
+    double soaMs = measureMs([&] {
+        for (float price : columns.column<2>())
+            soaCount += price > 250.f;
+    });
+
+    cout << "single-field scan over " << n << " Trade records (" << sizeof(Trade) << " bytes each)\n";
+    cout << "  AoS Container:         " << aosMs << " ms (" << aosCount << ")\n";
+    cout << "  SoA ColumnarContainer: " << soaMs << " ms (" << soaCount << ")\n";
+}
+
+/**
+ * 三段流水线(过滤、变换、截取)后求和：每一步都复制到临时Container vs 惰性融合的一次遍历。
+ */
+void benchmarkFusedPipeline(size_t n)
+{
+    Container<int> cont;
+    cont.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        cont.add((int)(i % 1000));
+    }
+    auto keep = [](int value) { return value % 3 != 0; };
+    auto scale = [](int value) { return value * 2 + 1; };
+    size_t limit = n / 2;
+
+    long long eagerSum = 0;
+    double eagerMs = measureMs([&] {
+        Container<int> filtered;
+        for (int value : cont)
+            if (keep(value))
+                filtered.add(value);
+        Container<int> transformed;
+        for (int value : filtered)
+            transformed.add(scale(value));
+        Container<int> taken;
+        for (size_t i = 0; i < limit && i < transformed.size(); i++)
+            taken.add(transformed[i]);
+        for (int value : taken)
+            eagerSum += value;
+    });
+
+    long long fusedSum = 0;
+    double fusedMs = measureMs([&] {
+        for (int value : view(cont).filter(keep).transform(scale).take(limit))
+            fusedSum += value;
+    });
+
+    cout << "filter -> transform -> take pipeline over " << n << " ints\n";
+    cout << "  eager temporaries: " << eagerMs << " ms (" << eagerSum << ")\n";
+    cout << "  fused views:       " << fusedMs << " ms (" << fusedSum << ")\n";
+}
+
+/**
+ * 压力测试用的记录：m_check总是m_value按位取反，读者读到未构造完或被撕裂的元素时校验会失败。
+ */
+struct StressRecord
+{
+    size_t m_value;
+    size_t m_check;
+
+    explicit StressRecord(size_t value = 0) : m_value(value), m_check(~value) {}
+    bool valid() const
+    {
+        return m_check == ~m_value;
+    }
+};
+
+/**
+ * 读写混合压力测试：固定时间内写者不断追加，读者反复遍历并校验每个元素。
+ * 对比ConcurrentContainer快照与用互斥锁保护的Container(读者遍历期间持锁，写者只能等待)的吞吐。
+ */
+void benchmarkConcurrentAppend()
+{
+    const int writers = 2, readers = 4;
+    const auto duration = chrono::milliseconds(1000);
+
+    auto run = [&](auto append, auto scan) {
+        atomic<size_t> appended(0), scanned(0);
+        atomic<bool> done(false), failed(false);
+        vector<thread> threads;
+        for (int w = 0; w < writers; w++)
+            threads.emplace_back([&, w] {
+                size_t count = 0;
+                while (!done.load(memory_order_relaxed))
+                    append(StressRecord(w * 1000000000ull + count++));
+                appended += count;
+            });
+        for (int r = 0; r < readers; r++)
+            threads.emplace_back([&] {
+                size_t count = 0;
+                while (!done.load(memory_order_relaxed))
+                    if (!scan(count))
+                        failed = true;
+                scanned += count;
+            });
+        this_thread::sleep_for(duration);
+        done = true;
+        for (thread &t : threads)
+            t.join();
+        double seconds = chrono::duration<double>(duration).count();
+        cout << "    " << appended / seconds / 1e6 << " M appends/s, " << scanned / seconds / 1e6
+             << " M elements scanned/s" << (failed ? ", CHECK FAILED" : ", all elements valid") << "\n";
+    };
+
+    cout << "mixed append/scan for 1 s, " << writers << " writers, " << readers << " readers\n";
+    {
+        ConcurrentContainer<StressRecord> cont;
+        cout << "  ConcurrentContainer snapshots:\n";
+        run([&](StressRecord record) { cont.add(record); },
+            [&](size_t &count) {
+                ConcurrentContainer<StressRecord>::Snapshot snapshot = cont.snapshot();
+                size_t seen = 0;
+                for (const StressRecord &record : snapshot)
+                {
+                    if (!record.valid())
+                        return false;
+                    seen++;
+                }
+                count += seen;
+                return seen == snapshot.size();
+            });
+    }
+    {
+        Container<StressRecord> cont;
+        mutex lock;
+        cout << "  Container + mutex:\n";
+        run([&](StressRecord record) {
+                lock_guard<mutex> guard(lock);
+                cont.add(record);
+            },
+            [&](size_t &count) {
+                lock_guard<mutex> guard(lock);
+                for (const StressRecord &record : cont)
+                {
+                    if (!record.valid())
+                        return false;
+                    count++;
+                }
+                return true;
+            });
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        size_t n = argc > 2 ? stoull(argv[2]) : 100000000;
+        benchmarkIteration(n);
+        benchmarkChunkedIteration(n);
+        benchmarkParallelForEach(n);
+        benchmarkColumnarScan(n);
+        benchmarkFusedPipeline(n);
+        benchmarkConcurrentAppend();
+        return 0;
+    }
     clientCode();
     return 0;
 }
\ No newline at end of file
@@ -1,5 +1,28 @@
 #include <iostream>
 #include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 /**
@@ -13,22 +36,106 @@ enum PrototypeTypeNum
     PROTOTYPE_2
 };
 
+/**
+ * 原型的共享状态(名字和字段)。
+ * 克隆体与注册的原型共享同一份状态，只有第一次真正修改时才复制一份(写时复制，Copy-On-Write)。
+ */
+struct PrototypeState
+{
+    string m_name;
+    float m_field;
+
+    PrototypeState(const string &name, float field = 0.f) : m_name(name), m_field(field) {}
+};
+
+/**
+ * 快照文件中一个原型的记录，定长部分之后紧跟m_nameLength个字节的名字(不含'\0')，整体按4字节对齐。
+ * 记录直接在内存映射的数据上读取，不需要解析。
+ */
+struct PrototypeRecord
+{
+    uint32_t m_kind; // 具体原型类，见PrototypeKind
+    float m_field;
+    float m_concreteField;
+    uint32_t m_nameLength;
+
+    const char *name() const
+    {
+        return reinterpret_cast<const char *>(this + 1);
+    }
+};
+
+/**
+ * 写入快照的具体原型类标识，只能追加，不能修改已有的值。
+ */
+enum PrototypeKind
+{
+    KIND_NONE = 0, // 不支持写入快照
+    KIND_CONCRETE_1 = 1,
+    KIND_CONCRETE_2
+};
+
 class Prototype
 {
 protected:
-    string m_prototypeName;
-    float m_prototypeField;
+    shared_ptr<PrototypeState> m_state;
+
+    /**
+     * 写操作之前调用：若状态仍与其他原型/克隆体共享，则先复制一份私有的状态。
+     */
+    PrototypeState &mutableState()
+    {
+        if (m_state.use_count() > 1)
+        {
+            m_state = make_shared<PrototypeState>(*m_state);
+        }
+        return *m_state;
+    }
 
 public:
-    Prototype() {}
-    Prototype(string name) : m_prototypeName(name) {}
+    Prototype() : m_state(make_shared<PrototypeState>("")) {}
+    Prototype(string name) : m_state(make_shared<PrototypeState>(name)) {}
+    Prototype(const PrototypeRecord &record)
+        : m_state(make_shared<PrototypeState>(string(record.name(), record.m_nameLength), record.m_field)) {}
 
     virtual ~Prototype() {}
     virtual Prototype *clone() const = 0; // 注意这个clone方法是prototype所独有的
+    /**
+     * 在调用方提供的内存上用placement new构造克隆体，供批量克隆(cloneN)使用。
+     * 内存大小和对齐至少为cloneSize()和cloneAlign()，析构由调用方显式调用析构函数完成。
+     */
+    virtual Prototype *cloneInto(void *memory) const = 0;
+    virtual size_t cloneSize() const = 0;
+    virtual size_t cloneAlign() const = 0;
+    /**
+     * 写入快照时调用，子类填写自己的类标识和字段，名字由快照写入方处理。
+     * 默认返回KIND_NONE，表示该原型不写入快照。
+     */
+    virtual PrototypeRecord toRecord() const
+    {
+        return PrototypeRecord{KIND_NONE, field(), 0.f, (uint32_t)name().size()};
+    }
     virtual void method(float field)
     {
-        this->m_prototypeField = field;
-        cout << "Call method from " << m_prototypeName << " with field: " << m_prototypeField << endl;
+        // 只有字段真正变化时才触发复制
+        if (m_state->m_field != field)
+        {
+            mutableState().m_field = field;
+        }
+        cout << "Call method from " << m_state->m_name << " with field: " << m_state->m_field << endl;
+    }
+
+    const string &name() const
+    {
+        return m_state->m_name;
+    }
+    float field() const
+    {
+        return m_state->m_field;
+    }
+    bool sharesStateWith(const Prototype &other) const
+    {
+        return m_state == other.m_state;
     }
 };
 
@@ -40,6 +147,8 @@ public:
  * 如果一个类拥有指针类型的成员变量，那么绝大部分情况下就需要深拷贝。
  * 只有这样，才能将指针指向的内容再复制出一份来，让原有对象和新生对象相互独立，彼此之间不受影响。
  * 如果类的成员变量没有指针，一般浅拷贝足以。
+ *
+ * 这里的名字等共享状态放在PrototypeState中，由拷贝构造函数浅拷贝(只增加引用计数)，写时才复制。
  */
 class ConcretePrototype1 : public Prototype
 {
@@ -49,6 +158,8 @@ private:
 public:
     ConcretePrototype1(string name, float field)
         : Prototype(name), m_concretePrototypeField1(field) {}
+    explicit ConcretePrototype1(const PrototypeRecord &record)
+        : Prototype(record), m_concretePrototypeField1(record.m_concreteField) {}
     /**
      * 请注意，克隆方法返回一个指向新的ConcretePrototype1副本的指针。
      * 因此，clientCode（调用克隆方法)有责任释放内存。
@@ -58,6 +169,22 @@ public:
     {
         return new ConcretePrototype1(*this);
     }
+    ConcretePrototype1 *cloneInto(void *memory) const override
+    {
+        return new (memory) ConcretePrototype1(*this);
+    }
+    size_t cloneSize() const override
+    {
+        return sizeof(ConcretePrototype1);
+    }
+    size_t cloneAlign() const override
+    {
+        return alignof(ConcretePrototype1);
+    }
+    PrototypeRecord toRecord() const override
+    {
+        return PrototypeRecord{KIND_CONCRETE_1, field(), m_concretePrototypeField1, (uint32_t)name().size()};
+    }
 };
 
 class ConcretePrototype2 : public Prototype
@@ -68,50 +195,1044 @@ private:
 public:
     ConcretePrototype2(string name, float field)
         : Prototype(name), m_concretePrototypeField2(field) {}
+    explicit ConcretePrototype2(const PrototypeRecord &record)
+        : Prototype(record), m_concretePrototypeField2(record.m_concreteField) {}
     ConcretePrototype2 *clone() const override
     {
         return new ConcretePrototype2(*this);
     }
+    ConcretePrototype2 *cloneInto(void *memory) const override
+    {
+        return new (memory) ConcretePrototype2(*this);
+    }
+    size_t cloneSize() const override
+    {
+        return sizeof(ConcretePrototype2);
+    }
+    size_t cloneAlign() const override
+    {
+        return alignof(ConcretePrototype2);
+    }
+    PrototypeRecord toRecord() const override
+    {
+        return PrototypeRecord{KIND_CONCRETE_2, field(), m_concretePrototypeField2, (uint32_t)name().size()};
+    }
 };
 
+/**
+ * Arena按块顺序分配内存(bump pointer)，分配出去的内存不能单独释放，Arena析构时整体释放。
+ * 只适合存放可平凡析构的对象，例如下面的GraphNode。
+ */
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = 64 * 1024)
+        : m_blockSize(blockSize), m_current(nullptr), m_remaining(0), m_bytesUsed(0) {}
+    ~Arena()
+    {
+        for (char *block : m_blocks)
+        {
+            delete[] block;
+        }
+    }
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * 预留至少bytes字节的连续空间，之后的分配在用完之前不会再申请新块。
+     */
+    void reserve(size_t bytes)
+    {
+        if (bytes > m_remaining)
+        {
+            newBlock(bytes);
+        }
+    }
+
+    void *allocate(size_t size, size_t align)
+    {
+        size_t padding = (align - reinterpret_cast<uintptr_t>(m_current) % align) % align;
+        if (m_current == nullptr || padding + size > m_remaining)
+        {
+            newBlock(max(m_blockSize, size + align));
+            padding = (align - reinterpret_cast<uintptr_t>(m_current) % align) % align;
+        }
+        char *result = m_current + padding;
+        m_current += padding + size;
+        m_remaining -= padding + size;
+        m_bytesUsed += padding + size;
+        return result;
+    }
+
+    size_t bytesUsed() const
+    {
+        return m_bytesUsed;
+    }
+
+private:
+    void newBlock(size_t size)
+    {
+        m_blocks.push_back(new char[size]);
+        m_current = m_blocks.back();
+        m_remaining = size;
+    }
+
+    size_t m_blockSize;
+    vector<char *> m_blocks;
+    char *m_current;
+    size_t m_remaining;
+    size_t m_bytesUsed;
+};
+
+/**
+ * 图中的节点，边数组紧跟在节点之后分配在同一个Arena中。边可以为空，也可以形成共享和环。
+ */
+struct GraphNode
+{
+    int m_value;
+    uint32_t m_edgeCount;
+    GraphNode **m_edges;
+};
+
+/**
+ * 在arena中分配一个带edgeCount条(空)边的节点。
+ */
+inline GraphNode *allocateGraphNode(Arena &arena, int value, uint32_t edgeCount)
+{
+    void *memory = arena.allocate(sizeof(GraphNode) + edgeCount * sizeof(GraphNode *), alignof(GraphNode));
+    GraphNode *node = new (memory) GraphNode{value, edgeCount, nullptr};
+    node->m_edges = reinterpret_cast<GraphNode **>(node + 1);
+    for (uint32_t i = 0; i < edgeCount; i++)
+    {
+        node->m_edges[i] = nullptr;
+    }
+    return node;
+}
+
+/**
+ * 把从root可达的整个图深拷贝到arena中，只遍历一次。
+ * 指针映射表记录"原节点 -> 新节点"：再次遇到同一个原节点时直接复用它的副本，
+ * 因此共享的节点仍然只有一份，环也能正确终止。nodeCountHint用于预留映射表，copiedNodes返回复制的节点数。
+ */
+inline GraphNode *cloneGraphIntoArena(const GraphNode *root, Arena &arena, size_t nodeCountHint, size_t *copiedNodes)
+{
+    if (root == nullptr)
+    {
+        *copiedNodes = 0;
+        return nullptr;
+    }
+    unordered_map<const GraphNode *, GraphNode *> remap;
+    remap.reserve(nodeCountHint);
+    vector<pair<const GraphNode *, GraphNode *>> pending; // 已分配但边还没填写的节点
+
+    auto copyOf = [&](const GraphNode *source) {
+        auto inserted = remap.emplace(source, nullptr);
+        if (inserted.second)
+        {
+            inserted.first->second = allocateGraphNode(arena, source->m_value, source->m_edgeCount);
+            pending.emplace_back(source, inserted.first->second);
+        }
+        return inserted.first->second;
+    };
+
+    GraphNode *result = copyOf(root);
+    while (!pending.empty())
+    {
+        const GraphNode *source = pending.back().first;
+        GraphNode *copy = pending.back().second;
+        pending.pop_back();
+        for (uint32_t i = 0; i < source->m_edgeCount; i++)
+        {
+            copy->m_edges[i] = source->m_edges[i] ? copyOf(source->m_edges[i]) : nullptr;
+        }
+    }
+    *copiedNodes = remap.size();
+    return result;
+}
+
+/**
+ * GraphPrototype拥有一个指针图(节点都分配在自己的Arena里)。
+ * 拷贝构造函数就是深拷贝：把从根可达的图一次性复制到新克隆体自己的Arena中，保留共享和环。
+ */
+class GraphPrototype : public Prototype
+{
+public:
+    explicit GraphPrototype(string name) : Prototype(name), m_root(nullptr), m_nodeCount(0) {}
+    GraphPrototype(const GraphPrototype &other) : Prototype(other), m_root(nullptr), m_nodeCount(0)
+    {
+        m_arena.reserve(other.m_arena.bytesUsed());
+        m_root = cloneGraphIntoArena(other.m_root, m_arena, other.m_nodeCount, &m_nodeCount);
+    }
+    GraphPrototype &operator=(const GraphPrototype &) = delete;
+
+    GraphPrototype *clone() const override
+    {
+        return new GraphPrototype(*this);
+    }
+    GraphPrototype *cloneInto(void *memory) const override
+    {
+        return new (memory) GraphPrototype(*this);
+    }
+    size_t cloneSize() const override
+    {
+        return sizeof(GraphPrototype);
+    }
+    size_t cloneAlign() const override
+    {
+        return alignof(GraphPrototype);
+    }
+
+    /**
+     * 构造原型时使用：在本原型的Arena中分配节点，边由调用方连接。克隆只复制从根可达的节点。
+     */
+    GraphNode *addNode(int value, uint32_t edgeCount)
+    {
+        m_nodeCount++;
+        return allocateGraphNode(m_arena, value, edgeCount);
+    }
+    void setRoot(GraphNode *root)
+    {
+        m_root = root;
+    }
+    const GraphNode *root() const
+    {
+        return m_root;
+    }
+    size_t nodeCount() const
+    {
+        return m_nodeCount;
+    }
+
+private:
+    Arena m_arena;
+    GraphNode *m_root;
+    size_t m_nodeCount;
+};
+
+/**
+ * PrototypeSlab持有一整块连续内存(slab)，其中依次构造了N个克隆体。
+ * 它是这些克隆体唯一的所有者：析构时统一调用每个克隆体的析构函数，然后一次性释放整块内存。
+ * 只能移动，不能拷贝。
+ */
+class PrototypeSlab
+{
+public:
+    PrototypeSlab() : m_memory(nullptr), m_stride(0), m_align(0), m_baseOffset(0), m_size(0) {}
+
+    /**
+     * 以prototype为模板，在一块内存中构造count个克隆体。
+     * 若某个克隆体的构造抛出异常，已构造的克隆体会被销毁，内存会被释放。
+     */
+    PrototypeSlab(const Prototype &prototype, size_t count)
+        : m_memory(nullptr), m_stride(0), m_align(prototype.cloneAlign()), m_baseOffset(0), m_size(0)
+    {
+        m_stride = (prototype.cloneSize() + m_align - 1) / m_align * m_align;
+        if (count == 0)
+        {
+            return;
+        }
+        m_memory = static_cast<char *>(::operator new(m_stride * count, align_val_t(m_align)));
+        try
+        {
+            for (; m_size < count; m_size++)
+            {
+                char *slot = m_memory + m_size * m_stride;
+                // 记录基类子对象在克隆体中的偏移，之后按下标访问时无需保存每个指针
+                m_baseOffset = reinterpret_cast<char *>(prototype.cloneInto(slot)) - slot;
+            }
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    PrototypeSlab(const PrototypeSlab &) = delete;
+    PrototypeSlab &operator=(const PrototypeSlab &) = delete;
+
+    PrototypeSlab(PrototypeSlab &&other) noexcept
+        : m_memory(other.m_memory), m_stride(other.m_stride), m_align(other.m_align),
+          m_baseOffset(other.m_baseOffset), m_size(other.m_size)
+    {
+        other.m_memory = nullptr;
+        other.m_size = 0;
+    }
+    PrototypeSlab &operator=(PrototypeSlab &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            m_memory = other.m_memory;
+            m_stride = other.m_stride;
+            m_align = other.m_align;
+            m_baseOffset = other.m_baseOffset;
+            m_size = other.m_size;
+            other.m_memory = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+    ~PrototypeSlab()
+    {
+        release();
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+    Prototype &operator[](size_t index)
+    {
+        return *reinterpret_cast<Prototype *>(m_memory + index * m_stride + m_baseOffset);
+    }
+    const Prototype &operator[](size_t index) const
+    {
+        return *reinterpret_cast<const Prototype *>(m_memory + index * m_stride + m_baseOffset);
+    }
+
+private:
+    void release()
+    {
+        for (size_t i = m_size; i > 0; i--)
+        {
+            (*this)[i - 1].~Prototype();
+        }
+        if (m_memory)
+        {
+            ::operator delete(m_memory, align_val_t(m_align));
+        }
+        m_memory = nullptr;
+        m_size = 0;
+    }
+
+    char *m_memory;
+    size_t m_stride; // 相邻克隆体之间的字节距离(按对齐向上取整后的对象大小)
+    size_t m_align;
+    ptrdiff_t m_baseOffset;
+    size_t m_size;
+};
+
+/**
+ * PrototypeRegistry是以稠密整数id(例如PrototypeTypeNum)直接索引的原型注册表。
+ * 槽位按块(chunk)分配，块目录和槽位都是原子指针：
+ * 查找只需两次原子读取，多个线程同时查找无需加锁；注册只在写者之间加锁，可以在运行时与查找并发进行。
+ * 被替换下来的原型可能仍在被其他线程克隆，因此先放入退休列表，注册表析构时再统一释放。
+ */
+class PrototypeRegistry
+{
+public:
+    static const size_t kChunkSize = 64;
+    static const size_t kMaxChunks = 1024;
+    static const size_t kCapacity = kChunkSize * kMaxChunks;
+
+    PrototypeRegistry()
+    {
+        for (size_t i = 0; i < kMaxChunks; i++)
+        {
+            m_chunks[i].store(nullptr, memory_order_relaxed);
+        }
+    }
+    ~PrototypeRegistry()
+    {
+        for (size_t i = 0; i < kMaxChunks; i++)
+        {
+            Chunk *chunk = m_chunks[i].load(memory_order_relaxed);
+            if (chunk)
+            {
+                for (size_t j = 0; j < kChunkSize; j++)
+                {
+                    delete chunk->m_slots[j].load(memory_order_relaxed);
+                }
+                delete chunk;
+            }
+        }
+        for (Prototype *prototype : m_retired)
+        {
+            delete prototype;
+        }
+    }
+    PrototypeRegistry(const PrototypeRegistry &) = delete;
+    PrototypeRegistry &operator=(const PrototypeRegistry &) = delete;
+
+    /**
+     * 注册(或替换)id对应的原型，注册表获得其所有权。id超出容量时返回false，原型仍归调用方所有。
+     */
+    bool add(size_t id, Prototype *prototype)
+    {
+        if (id >= kCapacity)
+        {
+            return false;
+        }
+        lock_guard<mutex> lock(m_writeMutex);
+        atomic<Chunk *> &chunkSlot = m_chunks[id / kChunkSize];
+        Chunk *chunk = chunkSlot.load(memory_order_relaxed);
+        if (chunk == nullptr)
+        {
+            chunk = new Chunk;
+            chunkSlot.store(chunk, memory_order_release);
+        }
+        Prototype *old = chunk->m_slots[id % kChunkSize].exchange(prototype, memory_order_acq_rel);
+        if (old)
+        {
+            m_retired.push_back(old);
+        }
+        return true;
+    }
+
+    /**
+     * 无锁查找，未注册的id返回nullptr(不会像unordered_map::operator[]那样插入空项)。
+     */
+    const Prototype *find(size_t id) const
+    {
+        if (id >= kCapacity)
+        {
+            return nullptr;
+        }
+        const Chunk *chunk = m_chunks[id / kChunkSize].load(memory_order_acquire);
+        if (chunk == nullptr)
+        {
+            return nullptr;
+        }
+        return chunk->m_slots[id % kChunkSize].load(memory_order_acquire);
+    }
+
+    /**
+     * 按id从小到大遍历已注册的原型。
+     */
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (size_t i = 0; i < kMaxChunks; i++)
+        {
+            const Chunk *chunk = m_chunks[i].load(memory_order_acquire);
+            for (size_t j = 0; chunk && j < kChunkSize; j++)
+            {
+                if (const Prototype *prototype = chunk->m_slots[j].load(memory_order_acquire))
+                {
+                    f(i * kChunkSize + j, *prototype);
+                }
+            }
+        }
+    }
+
+private:
+    struct Chunk
+    {
+        atomic<Prototype *> m_slots[kChunkSize];
+
+        Chunk()
+        {
+            for (size_t i = 0; i < kChunkSize; i++)
+            {
+                m_slots[i].store(nullptr, memory_order_relaxed);
+            }
+        }
+    };
+
+    atomic<Chunk *> m_chunks[kMaxChunks];
+    mutex m_writeMutex;
+    vector<Prototype *> m_retired;
+};
+
+/**
+ * 原型快照文件格式(本机字节序)：
+ *   PrototypeSnapshotHeader
+ *   uint64_t offsets[m_idCount]   下标为原型id，值为记录在文件中的偏移，0表示该id未注册
+ *   PrototypeRecord ...           每条记录按4字节对齐
+ */
+struct PrototypeSnapshotHeader
+{
+    char m_magic[4];
+    uint32_t m_version;
+    uint64_t m_idCount;
+};
+
+static const char kSnapshotMagic[4] = {'P', 'R', 'O', 'T'};
+static const uint32_t kSnapshotVersion = 1;
+
 class ProtoFactory
 {
 private:
-    std::unordered_map<PrototypeTypeNum, Prototype *, std::hash<int>> m_prototypes;
+    PrototypeRegistry m_prototypes;
 
 public:
     ProtoFactory()
     {
-        m_prototypes[PrototypeTypeNum::PROTOTYPE_1] = new ConcretePrototype1("Prototype_1", 50.f);
-        m_prototypes[PrototypeTypeNum::PROTOTYPE_2] = new ConcretePrototype2("Prototype_2", 52.f);
+        m_prototypes.add(PrototypeTypeNum::PROTOTYPE_1, new ConcretePrototype1("Prototype_1", 50.f));
+        m_prototypes.add(PrototypeTypeNum::PROTOTYPE_2, new ConcretePrototype2("Prototype_2", 52.f));
     }
-    ~ProtoFactory()
+
+    /**
+     * 运行时注册新的原型，可以与createPrototype并发调用。工厂获得prototype的所有权。
+     */
+    bool registerPrototype(size_t id, Prototype *prototype)
     {
-        delete m_prototypes[PrototypeTypeNum::PROTOTYPE_1];
-        delete m_prototypes[PrototypeTypeNum::PROTOTYPE_2];
+        return m_prototypes.add(id, prototype);
     }
 
-    Prototype *createPrototype(PrototypeTypeNum type)
+    /**
+     * 把所有已注册的原型写入快照文件，供SnapshotProtoFactory映射后直接克隆。
+     */
+    bool saveSnapshot(const string &path) const
+    {
+        vector<pair<size_t, const Prototype *>> entries;
+        m_prototypes.forEach([&entries](size_t id, const Prototype &prototype) {
+            entries.emplace_back(id, &prototype);
+        });
+        uint64_t idCount = entries.empty() ? 0 : entries.back().first + 1;
+
+        vector<uint64_t> offsets(idCount, 0);
+        vector<char> records;
+        uint64_t recordsBase = sizeof(PrototypeSnapshotHeader) + idCount * sizeof(uint64_t);
+        for (auto &entry : entries)
+        {
+            PrototypeRecord record = entry.second->toRecord();
+            if (record.m_kind == KIND_NONE)
+            {
+                continue;
+            }
+            size_t recordSize = (sizeof(record) + record.m_nameLength + 3) / 4 * 4;
+            size_t at = records.size();
+            records.resize(at + recordSize, 0);
+            memcpy(&records[at], &record, sizeof(record));
+            memcpy(&records[at + sizeof(record)], entry.second->name().data(), record.m_nameLength);
+            offsets[entry.first] = recordsBase + at;
+        }
+
+        PrototypeSnapshotHeader header;
+        memcpy(header.m_magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+        header.m_version = kSnapshotVersion;
+        header.m_idCount = idCount;
+
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+        out.write(records.data(), records.size());
+        return bool(out);
+    }
+
+    /**
+     * 未注册的类型返回nullptr。
+     */
+    Prototype *createPrototype(size_t type) const
     {
-        return m_prototypes[type]->clone();
+        const Prototype *prototype = m_prototypes.find(type);
+        return prototype ? prototype->clone() : nullptr;
     }
+
+    /**
+     * 批量克隆：一次分配，在slab中构造count个克隆体，并由返回的PrototypeSlab统一销毁。
+     * 适合每帧需要从模板生成大量实体的场景，避免逐个new/delete的开销。未注册的类型返回空的slab。
+     */
+    PrototypeSlab cloneN(size_t type, size_t count) const
+    {
+        const Prototype *prototype = m_prototypes.find(type);
+        return prototype ? PrototypeSlab(*prototype, count) : PrototypeSlab();
+    }
+};
+
+/**
+ * MappedFile把整个文件只读地映射到内存中。
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const string &path) : m_data(nullptr), m_size(0)
+    {
+#ifdef _WIN32
+        m_mapping = nullptr;
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_mapping)
+            {
+                m_data = static_cast<const char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+                m_size = m_data ? (size_t)size.QuadPart : 0;
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<const char *>(data);
+                m_size = st.st_size;
+            }
+        }
+        close(fd);
+#endif
+    }
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (m_data)
+        {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_mapping)
+        {
+            CloseHandle(m_mapping);
+        }
+#else
+        if (m_data)
+        {
+            munmap(const_cast<char *>(m_data), m_size);
+        }
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const
+    {
+        return m_data;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    const char *m_data;
+    size_t m_size;
+#ifdef _WIN32
+    HANDLE m_mapping;
+#endif
 };
 
+/**
+ * SnapshotProtoFactory在启动时只映射ProtoFactory::saveSnapshot写出的快照文件，不逐个构造原型。
+ * createPrototype按id在偏移表中找到记录，直接用映射的数据构造克隆体。
+ * 文件不存在、版本不符或者格式损坏时isValid()返回false，此时所有id都视为未注册。
+ */
+class SnapshotProtoFactory
+{
+public:
+    explicit SnapshotProtoFactory(const string &path) : m_file(path), m_offsets(nullptr), m_idCount(0)
+    {
+        const char *data = m_file.data();
+        if (data == nullptr || m_file.size() < sizeof(PrototypeSnapshotHeader))
+        {
+            return;
+        }
+        const PrototypeSnapshotHeader *header = reinterpret_cast<const PrototypeSnapshotHeader *>(data);
+        if (memcmp(header->m_magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+            header->m_version != kSnapshotVersion ||
+            header->m_idCount > (m_file.size() - sizeof(PrototypeSnapshotHeader)) / sizeof(uint64_t))
+        {
+            return;
+        }
+        const uint64_t *offsets = reinterpret_cast<const uint64_t *>(data + sizeof(PrototypeSnapshotHeader));
+        for (uint64_t i = 0; i < header->m_idCount; i++)
+        {
+            // 记录直接在映射的内存上读取，偏移不对齐就是损坏的文件
+            if (offsets[i] % alignof(PrototypeRecord) != 0)
+            {
+                return;
+            }
+        }
+        m_offsets = offsets;
+        m_idCount = header->m_idCount;
+    }
+
+    bool isValid() const
+    {
+        return m_offsets != nullptr;
+    }
+
+    /**
+     * 未注册的id或者损坏的记录返回nullptr。
+     */
+    Prototype *createPrototype(size_t type) const
+    {
+        if (type >= m_idCount || m_offsets[type] == 0 ||
+            m_offsets[type] > m_file.size() - sizeof(PrototypeRecord))
+        {
+            return nullptr;
+        }
+        const PrototypeRecord &record = *reinterpret_cast<const PrototypeRecord *>(m_file.data() + m_offsets[type]);
+        if (record.m_nameLength > m_file.size() - m_offsets[type] - sizeof(PrototypeRecord))
+        {
+            return nullptr;
+        }
+        switch (record.m_kind)
+        {
+        case KIND_CONCRETE_1:
+            return new ConcretePrototype1(record);
+        case KIND_CONCRETE_2:
+            return new ConcretePrototype2(record);
+        default:
+            return nullptr;
+        }
+    }
+
+private:
+    MappedFile m_file;
+    const uint64_t *m_offsets;
+    uint64_t m_idCount;
+};
+
+/**
+ * 临时目录中的快照文件路径。文件名带有随机后缀，同时运行的多个进程不会互相覆盖。
+ */
+string tempSnapshotPath(const string &name)
+{
+    return (filesystem::temp_directory_path() / (name + "_" + to_string(random_device()()) + ".snapshot")).string();
+}
+
 void clientCode()
 {
     ProtoFactory *prototypeFac = new ProtoFactory();
     Prototype *prototype = prototypeFac->createPrototype(PrototypeTypeNum::PROTOTYPE_1);
+    Prototype *sibling = prototypeFac->createPrototype(PrototypeTypeNum::PROTOTYPE_1);
+    cout << "Clones share state before write: " << boolalpha << prototype->sharesStateWith(*sibling) << endl;
     prototype->method(66.6);
+    cout << "Clones share state after write: " << prototype->sharesStateWith(*sibling) << endl;
+    delete sibling;
     delete prototype;
 
     prototype = prototypeFac->createPrototype(PrototypeTypeNum::PROTOTYPE_2);
     prototype->method(77.7);
     delete prototype;
+
+    if (prototypeFac->createPrototype(42) == nullptr)
+    {
+        cout << "Prototype 42 is not registered." << endl;
+    }
+    prototypeFac->registerPrototype(42, new ConcretePrototype1("Prototype_42", 42.f));
+    prototype = prototypeFac->createPrototype(42);
+    prototype->method(4.2f);
+    delete prototype;
+
+    PrototypeSlab slab = prototypeFac->cloneN(PrototypeTypeNum::PROTOTYPE_2, 3);
+    for (size_t i = 0; i < slab.size(); i++)
+    {
+        slab[i].method(80.f + i);
+    }
+
+    // 一个带共享节点和环的图：a -> b, a -> c, b -> d, c -> d, d -> a
+    GraphPrototype graph("Graph");
+    GraphNode *a = graph.addNode(1, 2), *b = graph.addNode(2, 1), *c = graph.addNode(3, 1), *d = graph.addNode(4, 1);
+    a->m_edges[0] = b;
+    a->m_edges[1] = c;
+    b->m_edges[0] = d;
+    c->m_edges[0] = d;
+    d->m_edges[0] = a;
+    graph.setRoot(a);
+    GraphPrototype *graphClone = graph.clone();
+    const GraphNode *root = graphClone->root();
+    cout << "Graph clone has " << graphClone->nodeCount() << " nodes, shared node kept: "
+         << (root->m_edges[0]->m_edges[0] == root->m_edges[1]->m_edges[0])
+         << ", cycle kept: " << (root->m_edges[0]->m_edges[0]->m_edges[0] == root)
+         << ", independent of original: " << (root != a) << endl;
+    delete graphClone;
+
+    string snapshotPath = tempSnapshotPath("prototypes");
+    prototypeFac->saveSnapshot(snapshotPath);
     delete prototypeFac;
+    {
+        SnapshotProtoFactory snapshotFac(snapshotPath);
+        prototype = snapshotFac.createPrototype(42);
+        if (prototype == nullptr)
+        {
+            cout << "Prototype 42 is not in the snapshot." << endl;
+        }
+        else
+        {
+            prototype->method(24.f);
+            delete prototype;
+        }
+    }
+    filesystem::remove(snapshotPath);
 }
 
-int main(void)
+/**
+ * 以下为性能测试代码，通过 `--bench` 参数运行。
+ */
+template <typename F>
+double measureMs(F &&f)
 {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * 写时复制之前的实现：每次克隆都深拷贝名字字符串。
+ */
+class DeepCopyPrototype
+{
+public:
+    DeepCopyPrototype(string name, float field) : m_prototypeName(name), m_prototypeField(field) {}
+    virtual ~DeepCopyPrototype() {}
+    virtual DeepCopyPrototype *clone() const
+    {
+        return new DeepCopyPrototype(*this);
+    }
+
+    /**
+     * 每个克隆体占用的内存：对象本身加上名字字符串在堆上的缓冲区(短字符串直接存在对象内)。
+     */
+    size_t memoryPerClone() const
+    {
+        const char *buffer = m_prototypeName.data();
+        bool inlineBuffer = buffer >= (const char *)this && buffer < (const char *)this + sizeof(*this);
+        return sizeof(*this) + (inlineBuffer ? 0 : m_prototypeName.capacity() + 1);
+    }
+
+private:
+    string m_prototypeName;
+    float m_prototypeField;
+};
+
+void benchmarkCopyOnWrite()
+{
+    const int N = 1000000;
+    const string longName(64, 'p'); // 超过短字符串优化(SSO)的长度，深拷贝需要额外分配
+    vector<Prototype *> cowClones(N);
+    vector<DeepCopyPrototype *> deepClones(N);
+    ConcretePrototype1 cowProto(longName, 1.f);
+    DeepCopyPrototype deepProto(longName, 1.f);
+
+    double deepMs = measureMs([&] {
+        for (int i = 0; i < N; i++)
+            deepClones[i] = deepProto.clone();
+    });
+
+    double cowMs = measureMs([&] {
+        for (int i = 0; i < N; i++)
+            cowClones[i] = cowProto.clone();
+    });
+    // 写时复制的克隆体只持有一个指向共享状态的引用，名字不再复制
+    size_t deepBytes = deepClones[0]->memoryPerClone();
+    size_t cowBytes = sizeof(ConcretePrototype1);
+
+    cout << "clone x" << N << " (name length " << longName.size() << ")\n";
+    cout << "  deep copy:     " << deepMs << " ms, " << deepBytes << " bytes/clone\n";
+    cout << "  copy-on-write: " << cowMs << " ms, " << cowBytes << " bytes/clone\n";
+
+    for (int i = 0; i < N; i++)
+    {
+        delete cowClones[i];
+        delete deepClones[i];
+    }
+}
+
+void benchmarkCloneN()
+{
+    const int frames = 100;
+    const size_t N = 50000;
+    ProtoFactory factory;
+    vector<Prototype *> clones(N);
+
+    double singleMs = measureMs([&] {
+        for (int f = 0; f < frames; f++)
+        {
+            for (size_t i = 0; i < N; i++)
+                clones[i] = factory.createPrototype(PrototypeTypeNum::PROTOTYPE_1);
+            for (size_t i = 0; i < N; i++)
+                delete clones[i];
+        }
+    });
+
+    double slabMs = measureMs([&] {
+        for (int f = 0; f < frames; f++)
+        {
+            PrototypeSlab slab = factory.cloneN(PrototypeTypeNum::PROTOTYPE_1, N);
+        }
+    });
+
+    cout << frames << " frames x " << N << " clones (create + destroy)\n";
+    cout << "  createPrototype + delete: " << singleMs / frames << " ms/frame\n";
+    cout << "  cloneN slab:              " << slabMs / frames << " ms/frame\n";
+}
+
+/**
+ * 多线程下查找原型并克隆：稠密无锁注册表 vs 读写锁保护的unordered_map。
+ */
+void benchmarkRegistryLookup()
+{
+    const size_t typeCount = 1024;
+    const int lookupsPerThread = 200000;
+    ProtoFactory factory;
+    unordered_map<size_t, Prototype *> mapPrototypes;
+    shared_mutex mapMutex;
+    for (size_t id = 0; id < typeCount; id++)
+    {
+        factory.registerPrototype(id, new ConcretePrototype1("Prototype_" + to_string(id), (float)id));
+        mapPrototypes[id] = new ConcretePrototype1("Prototype_" + to_string(id), (float)id);
+    }
+
+    auto runThreads = [&](int threadCount, auto lookup) {
+        return measureMs([&] {
+            vector<thread> threads;
+            for (int t = 0; t < threadCount; t++)
+            {
+                threads.emplace_back([&, t] {
+                    mt19937 rng(t);
+                    for (int i = 0; i < lookupsPerThread; i++)
+                    {
+                        delete lookup(rng() % typeCount);
+                    }
+                });
+            }
+            for (thread &th : threads)
+            {
+                th.join();
+            }
+        });
+    };
+
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    cout << "createPrototype lookups, " << typeCount << " registered types\n";
+    for (unsigned threadCount = 1; threadCount <= maxThreads * 2; threadCount *= 2)
+    {
+        double registryMs = runThreads(threadCount, [&](size_t id) { return factory.createPrototype(id); });
+        double mapMs = runThreads(threadCount, [&](size_t id) {
+            shared_lock<shared_mutex> lock(mapMutex);
+            return mapPrototypes.find(id)->second->clone();
+        });
+        double total = (double)threadCount * lookupsPerThread;
+        cout << "  " << threadCount << " threads: registry " << total / registryMs / 1000 << " M/s, "
+             << "locked unordered_map " << total / mapMs / 1000 << " M/s\n";
+    }
+
+    for (auto &entry : mapPrototypes)
+    {
+        delete entry.second;
+    }
+}
+
+/**
+ * 冷启动：逐个构造并注册原型 vs 映射快照文件，两者都在启动后克隆每个原型一次。
+ */
+void benchmarkSnapshotStartup()
+{
+    const size_t typeCount = 10000;
+    string snapshotPath = tempSnapshotPath("prototypes_bench");
+    auto buildFactory = [&](ProtoFactory &factory) {
+        for (size_t id = 0; id < typeCount; id++)
+        {
+            string name = "Prototype_with_a_longer_descriptive_name_" + to_string(id);
+            if (id % 2)
+                factory.registerPrototype(id, new ConcretePrototype1(name, (float)id));
+            else
+                factory.registerPrototype(id, new ConcretePrototype2(name, (float)id));
+        }
+    };
+    {
+        ProtoFactory factory;
+        buildFactory(factory);
+        factory.saveSnapshot(snapshotPath);
+    }
+
+    double rebuildMs = measureMs([&] {
+        ProtoFactory factory;
+        buildFactory(factory);
+        delete factory.createPrototype(typeCount - 1);
+    });
+    double snapshotMs = measureMs([&] {
+        SnapshotProtoFactory factory(snapshotPath);
+        delete factory.createPrototype(typeCount - 1);
+    });
+    double snapshotCloneMs = measureMs([&] {
+        SnapshotProtoFactory factory(snapshotPath);
+        for (size_t id = 0; id < typeCount; id++)
+            delete factory.createPrototype(id);
+    });
+
+    cout << "cold start with " << typeCount << " prototypes\n";
+    cout << "  rebuild ProtoFactory:          " << rebuildMs << " ms\n";
+    cout << "  map snapshot:                  " << snapshotMs << " ms\n";
+    cout << "  map snapshot + clone every id: " << snapshotCloneMs << " ms\n";
+    filesystem::remove(snapshotPath);
+}
+
+/**
+ * 深拷贝指针图：Arena一次遍历 vs 逐个节点new(同样使用指针映射表)。
+ * 每个节点有两条边：一条指向下一个节点(最后一个指回第一个，形成环)，一条指向随机节点(共享)。
+ */
+void benchmarkGraphClone()
+{
+    cout << "deep clone of cyclic graphs with shared nodes\n";
+    for (size_t n = 1000; n <= 1000000; n *= 10)
+    {
+        GraphPrototype graph("Graph");
+        vector<GraphNode *> nodes(n);
+        for (size_t i = 0; i < n; i++)
+            nodes[i] = graph.addNode((int)i, 2);
+        mt19937 rng(42);
+        for (size_t i = 0; i < n; i++)
+        {
+            nodes[i]->m_edges[0] = nodes[(i + 1) % n];
+            nodes[i]->m_edges[1] = nodes[rng() % n];
+        }
+        graph.setRoot(nodes[0]);
+
+        double arenaMs = measureMs([&] {
+            delete graph.clone();
+        });
+
+        double heapMs = measureMs([&] {
+            unordered_map<const GraphNode *, GraphNode *> remap;
+            remap.reserve(n);
+            vector<const GraphNode *> pending{graph.root()};
+            remap[graph.root()] = new GraphNode{graph.root()->m_value, 2, new GraphNode *[2]};
+            while (!pending.empty())
+            {
+                const GraphNode *source = pending.back();
+                pending.pop_back();
+                GraphNode *copy = remap[source];
+                for (uint32_t i = 0; i < source->m_edgeCount; i++)
+                {
+                    auto inserted = remap.emplace(source->m_edges[i], nullptr);
+                    if (inserted.second)
+                    {
+                        const GraphNode *edge = source->m_edges[i];
+                        inserted.first->second = new GraphNode{edge->m_value, edge->m_edgeCount, new GraphNode *[edge->m_edgeCount]};
+                        pending.push_back(edge);
+                    }
+                    copy->m_edges[i] = inserted.first->second;
+                }
+            }
+            for (auto &entry : remap)
+            {
+                delete[] entry.second->m_edges;
+                delete entry.second;
+            }
+        });
+
+        cout << "  " << n << " nodes: arena " << arenaMs << " ms, per-node new " << heapMs << " ms (incl. free)\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        benchmarkCopyOnWrite();
+        benchmarkCloneN();
+        benchmarkRegistryLookup();
+        benchmarkSnapshotStartup();
+        benchmarkGraphClone();
+        return 0;
+    }
     clientCode();
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,23 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <climits>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <queue>
+#include <cstdint>
+#include <sstream>
+#include <string_view>
+#include <new>
+#include <atomic>
+#include <variant>
+#include <stdexcept>
 using namespace std;
 
 /**
@@ -9,6 +26,45 @@ using namespace std;
  * Context使用这个接口去调用由Strategy子类实现的具体算法。
  */
 
+/**
+ * 结果的输出目标。Strategy把结果分一段或多段写入，不需要先拼成一个完整的string。
+ */
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+    virtual void write(const char *data, size_t size) = 0;
+};
+
+class OstreamSink : public OutputSink
+{
+public:
+    explicit OstreamSink(ostream &os) : m_os(os) {}
+    void write(const char *data, size_t size) override
+    {
+        m_os.write(data, size);
+    }
+
+private:
+    ostream &m_os;
+};
+
+/**
+ * 写入调用方的缓冲区。调用方在每次调用前clear()并重复使用同一个缓冲区，容量足够后就不再分配内存。
+ */
+class BufferSink : public OutputSink
+{
+public:
+    explicit BufferSink(string &buffer) : m_buffer(buffer) {}
+    void write(const char *data, size_t size) override
+    {
+        m_buffer.append(data, size);
+    }
+
+private:
+    string &m_buffer;
+};
+
 /**
  * Strategy 基类，这里只提供接口，没有具体的实现。
  */
@@ -17,6 +73,16 @@ class Strategy
 public:
     virtual ~Strategy() {}
     virtual string doAlgorithm(const vector<string> &data) const = 0;
+
+    /**
+     * 非拥有视图版本：data指向调用方自己的缓冲区，结果写入sink。
+     * 默认实现先复制成vector<string>再调用上面的版本；子类重载它就可以直接处理调用方的数据，不做复制。
+     */
+    virtual void doAlgorithm(const vector<string_view> &data, OutputSink &sink) const
+    {
+        string result = doAlgorithm(vector<string>(data.begin(), data.end()));
+        sink.write(result.data(), result.size());
+    }
 };
 
 /**
@@ -57,6 +123,14 @@ public:
         // ...
     }
 
+    /**
+     * 调用方提供数据和输出目标：Strategy直接读取调用方的缓冲区并把结果写入sink，Context不构造任何临时对象。
+     */
+    void doBusiness(const vector<string_view> &data, OutputSink &sink) const
+    {
+        this->p_strategy->doAlgorithm(data, sink);
+    }
+
 private:
     /**
      * Context维护一个Strategy对象的引用。Context不知道Strategy的具体实现类。
@@ -65,6 +139,79 @@ private:
     Strategy *p_strategy;
 };
 
+/**
+ * 视图版本排序用的每线程暂存区：容量足够时直接复用，不再分配内存。
+ * 一次输入超过kRetainLimit字节时，用完就释放，避免一次大排序让线程在整个生命周期里都占着这块内存。
+ * allocations()统计暂存区分配内存的次数，供性能测试使用。
+ */
+class ScratchBuffer
+{
+public:
+    static const size_t kRetainLimit = 1 << 20;
+
+    explicit ScratchBuffer(size_t size) : m_buffer(threadBuffer())
+    {
+        m_buffer.clear();
+        if (m_buffer.capacity() < size)
+        {
+            s_allocations.fetch_add(1, memory_order_relaxed);
+            m_buffer.reserve(size);
+        }
+    }
+    ~ScratchBuffer()
+    {
+        if (m_buffer.capacity() > kRetainLimit)
+        {
+            string().swap(m_buffer);
+        }
+    }
+    ScratchBuffer(const ScratchBuffer &) = delete;
+    ScratchBuffer &operator=(const ScratchBuffer &) = delete;
+
+    string &str()
+    {
+        return m_buffer;
+    }
+
+    static size_t allocations()
+    {
+        return s_allocations.load(memory_order_relaxed);
+    }
+
+private:
+    static string &threadBuffer()
+    {
+        static thread_local string buffer;
+        return buffer;
+    }
+
+    string &m_buffer;
+    static inline atomic<size_t> s_allocations{0};
+};
+
+/**
+ * 把各段输入拼接到暂存区中，返回拼接结果。
+ */
+string &concatenate(ScratchBuffer &scratch, const vector<string_view> &data)
+{
+    string &buffer = scratch.str();
+    for (string_view letter : data)
+    {
+        buffer.append(letter.data(), letter.size());
+    }
+    return buffer;
+}
+
+size_t totalSize(const vector<string_view> &data)
+{
+    size_t total = 0;
+    for (string_view letter : data)
+    {
+        total += letter.size();
+    }
+    return total;
+}
+
 /**
  * 具体Strategy A和B在遵循基类Strategy接口的同时实现算法。
  */
@@ -81,10 +228,22 @@ public:
 
         return result;
     }
+
+    /**
+     * 排序需要一块可写的缓冲区，这里使用每个线程复用的ScratchBuffer，容量足够后不再分配内存。
+     */
+    void doAlgorithm(const vector<string_view> &data, OutputSink &sink) const override
+    {
+        ScratchBuffer scratch(totalSize(data));
+        string &buffer = concatenate(scratch, data);
+        sort(buffer.begin(), buffer.end());
+        sink.write(buffer.data(), buffer.size());
+    }
 };
 
 class ConcreteStrategyB : public Strategy
 {
+public:
     string doAlgorithm(const vector<string> &data) const override
     {
         string result;
@@ -99,6 +258,760 @@ class ConcreteStrategyB : public Strategy
 
         return result;
     }
+
+    void doAlgorithm(const vector<string_view> &data, OutputSink &sink) const override
+    {
+        ScratchBuffer scratch(totalSize(data));
+        string &buffer = concatenate(scratch, data);
+        sort(buffer.begin(), buffer.end(), greater<char>());
+        sink.write(buffer.data(), buffer.size());
+    }
+};
+
+/**
+ * 计数排序Strategy：字符只有256种取值，统计每种字符出现的次数后按顺序一次性填充结果，复杂度O(n)。
+ * 统计时使用4张子直方图轮流计数，相邻字符相同时不会连续读写同一个计数器，
+ * 打破了"读-加-写"的依赖链，使编译器和CPU可以并行执行多个计数，最后再合并。
+ * descending为true时直接按从大到小的顺序填充，不需要再反转。
+ * 输出与ConcreteStrategyA(升序)或ConcreteStrategyB(降序)完全一致，包括char为有符号类型时的顺序。
+ */
+class CountingSortStrategy : public Strategy
+{
+public:
+    explicit CountingSortStrategy(bool descending = false) : m_descending(descending) {}
+
+    string doAlgorithm(const vector<string> &data) const override
+    {
+        Histogram histogram;
+        for (const string &letter : data)
+        {
+            histogram.add(letter.data(), letter.size());
+        }
+
+        string result(histogram.m_total, '\0');
+        char *out = &result[0];
+        emit(histogram, [&out](char c, size_t count) {
+            memset(out, c, count);
+            out += count;
+        });
+        return result;
+    }
+
+    /**
+     * 直接统计调用方的数据，结果分段写入sink，整个过程不分配内存。
+     */
+    void doAlgorithm(const vector<string_view> &data, OutputSink &sink) const override
+    {
+        Histogram histogram;
+        for (string_view letter : data)
+        {
+            histogram.add(letter.data(), letter.size());
+        }
+
+        char fill[1024];
+        emit(histogram, [&](char c, size_t count) {
+            memset(fill, c, min(count, sizeof(fill)));
+            for (; count > 0; count -= min(count, sizeof(fill)))
+            {
+                sink.write(fill, min(count, sizeof(fill)));
+            }
+        });
+    }
+
+private:
+    struct Histogram
+    {
+        size_t m_counts[4][256] = {};
+        size_t m_total = 0;
+
+        void add(const char *data, size_t n)
+        {
+            const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                m_counts[0][p[i]]++;
+                m_counts[1][p[i + 1]]++;
+                m_counts[2][p[i + 2]]++;
+                m_counts[3][p[i + 3]]++;
+            }
+            for (; i < n; i++)
+            {
+                m_counts[0][p[i]]++;
+            }
+            m_total += n;
+        }
+    };
+
+    /**
+     * 按char的大小顺序(或逆序)对每种出现过的字符调用output(字符, 次数)。
+     */
+    template <typename F>
+    void emit(const Histogram &histogram, F output) const
+    {
+        for (int i = 0; i <= CHAR_MAX - CHAR_MIN; i++)
+        {
+            char c = (char)(m_descending ? CHAR_MAX - i : CHAR_MIN + i);
+            unsigned char byte = (unsigned char)c;
+            size_t count = histogram.m_counts[0][byte] + histogram.m_counts[1][byte] +
+                           histogram.m_counts[2][byte] + histogram.m_counts[3][byte];
+            if (count > 0)
+            {
+                output(c, count);
+            }
+        }
+    }
+
+    bool m_descending;
+};
+
+/**
+ * 多核排序Strategy：结果与ConcreteStrategyA相同。
+ * 输入足够大时，把拼接后的字符串分成m_threads块并行排序，再逐轮两两归并；
+ * 每次归并本身也是并行的：用merge path(二分查找划分点)把输出切成若干段，各段可以独立归并。
+ * 输入小于m_cutoff字节时，多线程的开销得不偿失，直接使用顺序排序。
+ */
+class ParallelSortStrategy : public Strategy
+{
+public:
+    explicit ParallelSortStrategy(size_t threads = thread::hardware_concurrency(), size_t cutoff = 1 << 16)
+        : m_threads(max(threads, (size_t)1)), m_cutoff(cutoff) {}
+
+    // 没有重载视图版本，沿用基类的默认实现；不写using的话会被下面的重载隐藏，StaticContext无法调用
+    using Strategy::doAlgorithm;
+
+    string doAlgorithm(const vector<string> &data) const override
+    {
+        string result;
+        for_each(data.begin(), data.end(), [&result](const string &letter) {
+            result += letter;
+        });
+        if (result.size() < m_cutoff || m_threads == 1)
+        {
+            sort(result.begin(), result.end());
+            return result;
+        }
+
+        size_t n = result.size();
+        vector<size_t> bounds;
+        for (size_t i = 0; i <= m_threads; i++)
+        {
+            bounds.push_back(n * i / m_threads);
+        }
+        runParallel(m_threads, [&](size_t i) {
+            sort(result.begin() + bounds[i], result.begin() + bounds[i + 1]);
+        });
+
+        // 每轮把相邻两段归并成一段，在result和buffer之间交替
+        string buffer(n, '\0');
+        string *from = &result, *to = &buffer;
+        while (bounds.size() > 2)
+        {
+            vector<size_t> merged;
+            size_t pairs = (bounds.size() - 1) / 2;
+            size_t workersPerPair = max(m_threads / max(pairs, (size_t)1), (size_t)1);
+            for (size_t p = 0; p < pairs; p++)
+            {
+                merged.push_back(bounds[2 * p]);
+            }
+            if ((bounds.size() - 1) % 2)
+            {
+                // 段数为奇数时最后一段原样复制
+                size_t last = bounds.size() - 2;
+                copy(from->begin() + bounds[last], from->begin() + bounds[last + 1], to->begin() + bounds[last]);
+                merged.push_back(bounds[last]);
+            }
+            merged.push_back(n);
+            runParallel(pairs * workersPerPair, [&](size_t task) {
+                size_t p = task / workersPerPair, part = task % workersPerPair;
+                const char *a = from->data() + bounds[2 * p], *b = from->data() + bounds[2 * p + 1];
+                size_t m = bounds[2 * p + 1] - bounds[2 * p], k = bounds[2 * p + 2] - bounds[2 * p + 1];
+                mergePart(a, m, b, k, &(*to)[bounds[2 * p]], part, workersPerPair);
+            });
+            bounds.swap(merged);
+            swap(from, to);
+        }
+        return *from;
+    }
+
+private:
+    template <typename F>
+    static void runParallel(size_t count, F f)
+    {
+        vector<thread> workers;
+        for (size_t i = 1; i < count; i++)
+        {
+            workers.emplace_back(f, i);
+        }
+        f(0);
+        for (thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    /**
+     * 在有序的a[0, m)和b[0, n)归并结果中，前k个元素里来自a的个数(a中相等的元素排在前面，与std::merge一致)。
+     */
+    static size_t coRank(size_t k, const char *a, size_t m, const char *b, size_t n)
+    {
+        size_t low = k > n ? k - n : 0, high = min(k, m);
+        while (low < high)
+        {
+            size_t i = low + (high - low) / 2, j = k - i;
+            if (j > 0 && i < m && b[j - 1] >= a[i])
+            {
+                low = i + 1;
+            }
+            else
+            {
+                high = i;
+            }
+        }
+        return low;
+    }
+
+    /**
+     * 归并结果的第part段(共parts段)，各段互不重叠，可以并行计算。
+     */
+    static void mergePart(const char *a, size_t m, const char *b, size_t n, char *out, size_t part, size_t parts)
+    {
+        size_t begin = (m + n) * part / parts, end = (m + n) * (part + 1) / parts;
+        size_t ai = coRank(begin, a, m, b, n), ae = coRank(end, a, m, b, n);
+        merge(a + ai, a + ae, b + (begin - ai), b + (end - ae), out + begin);
+    }
+
+    size_t m_threads;
+    size_t m_cutoff;
+};
+
+/**
+ * 流式Strategy的输入来源：每次读取最多capacity个字节，返回0表示读完。
+ */
+class InputSource
+{
+public:
+    virtual ~InputSource() {}
+    virtual size_t read(char *buffer, size_t capacity) = 0;
+};
+
+class FileInputSource : public InputSource
+{
+public:
+    explicit FileInputSource(const string &path) : m_file(path, ios::binary) {}
+
+    bool isOpen() const
+    {
+        return m_file.is_open();
+    }
+    size_t read(char *buffer, size_t capacity) override
+    {
+        m_file.read(buffer, capacity);
+        return (size_t)m_file.gcount();
+    }
+
+private:
+    ifstream m_file;
+};
+
+/**
+ * 由函数生成输入，函数的参数和返回值与InputSource::read相同。
+ */
+class GeneratorInputSource : public InputSource
+{
+public:
+    explicit GeneratorInputSource(function<size_t(char *, size_t)> generator) : m_generator(generator) {}
+
+    size_t read(char *buffer, size_t capacity) override
+    {
+        return m_generator(buffer, capacity);
+    }
+
+private:
+    function<size_t(char *, size_t)> m_generator;
+};
+
+/**
+ * 流式排序的统计结果：临时文件的读写量、归并的趟数以及排序过程中自己申请的缓冲区的峰值。
+ */
+struct StreamingSortReport
+{
+    uint64_t m_inputBytes = 0;
+    uint64_t m_tempBytesWritten = 0;
+    uint64_t m_tempBytesRead = 0;
+    size_t m_runs = 0;
+    size_t m_mergePasses = 0;
+    size_t m_peakMemoryBytes = 0;
+};
+
+/**
+ * 流式Strategy接口：输入不必一次装入内存，结果直接写到输出流。
+ */
+class StreamingStrategy
+{
+public:
+    virtual ~StreamingStrategy() {}
+    virtual StreamingSortReport doAlgorithm(InputSource &input, ostream &output) const = 0;
+};
+
+/**
+ * 外部归并排序：结果与ConcreteStrategyA相同，但内存用量不超过m_memoryBudget。
+ * 1. 每次读入最多m_memoryBudget字节，排序后写成一个有序的临时文件(run)；
+ * 2. 用小顶堆做k路归并；run太多、每路缓冲区会小于kMinMergeBuffer时，先分组归并成更大的run，再继续。
+ * 输入只有一个run时不写临时文件，直接输出。
+ * 临时文件名带有进程内唯一的编号，同一个对象可以被多个线程同时调用。
+ * 临时文件或输出流读写失败时抛出runtime_error；无论成功还是失败，返回前都会删除所有临时文件。
+ */
+class ExternalSortStrategy : public StreamingStrategy
+{
+public:
+    static const size_t kMinMergeBuffer = 64 * 1024;
+
+    explicit ExternalSortStrategy(size_t memoryBudget = (size_t)256 * 1024 * 1024,
+                                  const string &tempDirectory = filesystem::temp_directory_path().string())
+        : m_memoryBudget(max(memoryBudget, 2 * kMinMergeBuffer)), m_tempDirectory(tempDirectory) {}
+
+    StreamingSortReport doAlgorithm(InputSource &input, ostream &output) const override
+    {
+        StreamingSortReport report;
+        string buffer;
+        size_t filled = fillRun(input, buffer);
+        report.m_inputBytes += filled;
+        report.m_peakMemoryBytes = buffer.size();
+        sort(buffer.begin(), buffer.begin() + filled);
+        if (filled < m_memoryBudget)
+        {
+            // 全部输入一次就装下了，不需要临时文件
+            output.write(buffer.data(), filled);
+            check(output, "write output");
+            report.m_runs = 1;
+            return report;
+        }
+
+        TempFiles temps;
+        string prefix = tempPrefix();
+        vector<string> runs;
+        do
+        {
+            runs.push_back(temps.add(prefix + to_string(report.m_runs++)));
+            ofstream run(runs.back(), ios::binary);
+            run.write(buffer.data(), filled);
+            run.close();
+            check(run, "write " + runs.back());
+            report.m_tempBytesWritten += filled;
+
+            filled = fillRun(input, buffer);
+            report.m_inputBytes += filled;
+            sort(buffer.begin(), buffer.begin() + filled);
+        } while (filled > 0);
+        string().swap(buffer); // 归并阶段按路数重新分配缓冲区
+
+        size_t fanIn = max(m_memoryBudget / kMinMergeBuffer - 1, (size_t)2);
+        size_t nextRun = report.m_runs;
+        while (runs.size() > fanIn)
+        {
+            vector<string> merged;
+            for (size_t i = 0; i < runs.size(); i += fanIn)
+            {
+                vector<string> group(runs.begin() + i, runs.begin() + min(i + fanIn, runs.size()));
+                merged.push_back(temps.add(prefix + to_string(nextRun++)));
+                ofstream out(merged.back(), ios::binary);
+                check(out, "create " + merged.back());
+                report.m_tempBytesWritten += mergeRuns(group, out, report);
+                out.close();
+                check(out, "write " + merged.back());
+            }
+            runs.swap(merged);
+            report.m_mergePasses++;
+        }
+        mergeRuns(runs, output, report);
+        check(output, "write output");
+        report.m_mergePasses++;
+        return report;
+    }
+
+private:
+    /**
+     * 读入一个run。缓冲区从kMinMergeBuffer起按需倍增，最多到m_memoryBudget，
+     * 小输入不会一上来就分配并清零整个内存预算。返回读到的字节数，小于m_memoryBudget说明输入已经读完。
+     */
+    size_t fillRun(InputSource &input, string &buffer) const
+    {
+        if (buffer.empty())
+        {
+            buffer.resize(min((size_t)kMinMergeBuffer, m_memoryBudget));
+        }
+        size_t filled = 0;
+        while (true)
+        {
+            filled += readFully(input, &buffer[filled], buffer.size() - filled);
+            if (filled < buffer.size() || buffer.size() == m_memoryBudget)
+            {
+                return filled;
+            }
+            buffer.resize(min(buffer.size() * 2, m_memoryBudget));
+        }
+    }
+
+    static size_t readFully(InputSource &input, char *buffer, size_t capacity)
+    {
+        size_t filled = 0, n;
+        while (filled < capacity && (n = input.read(buffer + filled, capacity - filled)) > 0)
+        {
+            filled += n;
+        }
+        return filled;
+    }
+
+    /**
+     * 记录本次调用创建的临时文件，析构时全部删除(已经删除的忽略)。
+     */
+    struct TempFiles
+    {
+        vector<string> m_paths;
+
+        const string &add(string path)
+        {
+            m_paths.push_back(std::move(path));
+            return m_paths.back();
+        }
+        ~TempFiles()
+        {
+            for (const string &path : m_paths)
+            {
+                error_code ignored;
+                filesystem::remove(path, ignored);
+            }
+        }
+    };
+
+    /**
+     * 每次调用的临时文件名前缀：进程启动时的随机数区分同时运行的进程，递增的编号区分同一进程中的各次调用。
+     */
+    string tempPrefix() const
+    {
+        static const uint64_t processToken = ((uint64_t)random_device()() << 32) | random_device()();
+        static atomic<uint64_t> nextCall(0);
+        return (filesystem::path(m_tempDirectory) / ("strategy_run_" + to_string(processToken) + "_" +
+                                                     to_string(nextCall.fetch_add(1)) + "_"))
+            .string();
+    }
+
+    static void check(const ios &stream, const string &what)
+    {
+        if (!stream)
+        {
+            throw runtime_error("ExternalSortStrategy: failed to " + what);
+        }
+    }
+
+    /**
+     * 把若干个有序的run归并写到out，归并完删除这些run，返回写出的字节数。
+     * 每路输入和输出各分到m_memoryBudget / (路数 + 1)字节的缓冲区。
+     */
+    uint64_t mergeRuns(const vector<string> &runs, ostream &out, StreamingSortReport &report) const
+    {
+        struct Reader
+        {
+            ifstream m_file;
+            string m_buffer;
+            size_t m_position = 0;
+            size_t m_size = 0;
+        };
+        size_t bufferSize = m_memoryBudget / (runs.size() + 1);
+        vector<Reader> readers(runs.size());
+        string outBuffer;
+        outBuffer.reserve(bufferSize);
+        report.m_peakMemoryBytes = max(report.m_peakMemoryBytes, bufferSize * (runs.size() + 1));
+
+        auto refill = [&](Reader &reader) {
+            reader.m_file.read(&reader.m_buffer[0], reader.m_buffer.size());
+            if (reader.m_file.bad())
+            {
+                throw runtime_error("ExternalSortStrategy: failed to read a temporary run");
+            }
+            reader.m_size = (size_t)reader.m_file.gcount();
+            reader.m_position = 0;
+            report.m_tempBytesRead += reader.m_size;
+            return reader.m_size > 0;
+        };
+
+        typedef pair<char, size_t> Head; // (当前字符, 第几路)
+        priority_queue<Head, vector<Head>, greater<Head>> heap;
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            readers[i].m_file.open(runs[i], ios::binary);
+            check(readers[i].m_file, "open " + runs[i]);
+            readers[i].m_buffer.assign(bufferSize, '\0');
+            if (refill(readers[i]))
+            {
+                heap.emplace(readers[i].m_buffer[0], i);
+            }
+        }
+
+        uint64_t written = 0;
+        while (!heap.empty())
+        {
+            Head head = heap.top();
+            heap.pop();
+            Reader &reader = readers[head.second];
+            // 把这一路中所有不大于下一个堆顶的字符一次性输出，相同字符很多时大大减少堆操作
+            char limit = heap.empty() ? CHAR_MAX : heap.top().first;
+            do
+            {
+                outBuffer.push_back(reader.m_buffer[reader.m_position++]);
+                if (outBuffer.size() == bufferSize)
+                {
+                    out.write(outBuffer.data(), outBuffer.size());
+                    check(out, "write merged output");
+                    written += outBuffer.size();
+                    outBuffer.clear();
+                }
+                if (reader.m_position == reader.m_size && !refill(reader))
+                {
+                    break;
+                }
+            } while (reader.m_buffer[reader.m_position] <= limit);
+            if (reader.m_position < reader.m_size)
+            {
+                heap.emplace(reader.m_buffer[reader.m_position], head.second);
+            }
+        }
+        out.write(outBuffer.data(), outBuffer.size());
+        written += outBuffer.size();
+
+        // 归并完的run马上删除，减少磁盘占用；失败时由doAlgorithm中的TempFiles清理
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            readers[i].m_file.close();
+            error_code ignored;
+            filesystem::remove(runs[i], ignored);
+        }
+        return written;
+    }
+
+    size_t m_memoryBudget;
+    string m_tempDirectory;
+};
+
+/**
+ * StaticContext在编译期确定Strategy类型：Strategy对象直接内联存放在Context中，
+ * 调用时用限定名S::doAlgorithm，是普通的非虚调用，编译器还可以把它内联。
+ * 代价是运行时不能再切换Strategy类型，只能重新赋一个同类型的Strategy。
+ */
+template <typename S>
+class StaticContext
+{
+public:
+    explicit StaticContext(S strategy = S()) : m_strategy(strategy) {}
+
+    void setStrategy(S strategy)
+    {
+        m_strategy = strategy;
+    }
+
+    string doBusiness(const vector<string> &data) const
+    {
+        return m_strategy.S::doAlgorithm(data);
+    }
+    void doBusiness(const vector<string_view> &data, OutputSink &sink) const
+    {
+        m_strategy.S::doAlgorithm(data, sink);
+    }
+
+private:
+    S m_strategy;
+};
+
+/**
+ * VariantContext在一组已知的Strategy类型之间切换：当前Strategy内联存放在std::variant中，
+ * setStrategy不需要堆分配，调用时按variant的下标分派到具体类型的非虚调用。
+ */
+template <typename... Ss>
+class VariantContext
+{
+public:
+    template <typename S>
+    explicit VariantContext(S strategy) : m_strategy(strategy) {}
+
+    template <typename S>
+    void setStrategy(S strategy)
+    {
+        m_strategy = strategy;
+    }
+
+    string doBusiness(const vector<string> &data) const
+    {
+        return visit([&data](const auto &strategy) {
+            typedef decay_t<decltype(strategy)> S;
+            return strategy.S::doAlgorithm(data);
+        },
+                     m_strategy);
+    }
+    void doBusiness(const vector<string_view> &data, OutputSink &sink) const
+    {
+        visit([&data, &sink](const auto &strategy) {
+            typedef decay_t<decltype(strategy)> S;
+            strategy.S::doAlgorithm(data, sink);
+        },
+              m_strategy);
+    }
+
+private:
+    variant<Ss...> m_strategy;
+};
+
+/**
+ * 生成总长度为bytes的随机字符输入，每个字符串4KB。
+ */
+vector<string> makeInput(size_t bytes)
+{
+    mt19937 rng(7);
+    vector<string> data;
+    for (size_t done = 0; done < bytes;)
+    {
+        size_t n = min(bytes - done, (size_t)4096);
+        string piece(n, '\0');
+        for (char &c : piece)
+        {
+            c = (char)('a' + rng() % 26);
+        }
+        data.push_back(move(piece));
+        done += n;
+    }
+    return data;
+}
+
+/**
+ * AdaptiveContext在启动时对所有注册的Strategy做一次校准：在几种不同大小的样例输入上计时，
+ * 为每个大小区间记录最快的Strategy。之后每次doBusiness按输入的总字节数查表选择Strategy。
+ * 注册的Strategy必须可以互相替换(结果相同)：以第一个注册的Strategy为基准，校准时结果不同的Strategy不会被选中。
+ */
+class AdaptiveContext
+{
+public:
+    /**
+     * 判定表中的一项：总字节数不超过m_maxBytes的输入使用m_strategy。m_timesMs是校准时各Strategy的耗时，
+     * 结果与基准不同的Strategy耗时记为负数。
+     */
+    struct Decision
+    {
+        size_t m_maxBytes;
+        size_t m_strategy;
+        vector<double> m_timesMs;
+    };
+
+    /**
+     * 注册一个Strategy，AdaptiveContext获得其所有权。注册之后需要重新calibrate()。
+     */
+    void addStrategy(const string &name, Strategy *strategy)
+    {
+        m_names.push_back(name);
+        m_strategies.emplace_back(strategy);
+    }
+
+    /**
+     * 在每个样例大小上运行所有Strategy(每个取repeats次中的最短时间)，生成判定表。
+     */
+    void calibrate(const vector<size_t> &sampleBytes = {16, 256, 4096, 65536, 1 << 20}, int repeats = 3)
+    {
+        m_table.clear();
+        for (size_t bytes : sampleBytes)
+        {
+            vector<string> sample = makeInput(bytes);
+            Decision decision{bytes, 0, vector<double>(m_strategies.size(), 0.)};
+            string reference;
+            for (size_t i = 0; i < m_strategies.size(); i++)
+            {
+                string result;
+                double best = 1e300;
+                for (int r = 0; r < repeats; r++)
+                {
+                    auto start = chrono::steady_clock::now();
+                    result = m_strategies[i]->doAlgorithm(sample);
+                    best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+                }
+                if (i == 0)
+                {
+                    reference = result;
+                }
+                decision.m_timesMs[i] = (result == reference) ? best : -1.;
+                if (decision.m_timesMs[i] >= 0 && best < decision.m_timesMs[decision.m_strategy])
+                {
+                    decision.m_strategy = i;
+                }
+            }
+            m_table.push_back(decision);
+        }
+        sort(m_table.begin(), m_table.end(), [](const Decision &a, const Decision &b) {
+            return a.m_maxBytes < b.m_maxBytes;
+        });
+    }
+
+    /**
+     * 按输入大小选择Strategy并执行。没有注册Strategy时返回空字符串，未校准时使用第一个Strategy。
+     */
+    string doBusiness(const vector<string> &data) const
+    {
+        if (m_strategies.empty())
+        {
+            return string();
+        }
+        size_t bytes = 0;
+        for (const string &letter : data)
+        {
+            bytes += letter.size();
+        }
+        return m_strategies[choose(bytes)]->doAlgorithm(data);
+    }
+
+    /**
+     * 返回总字节数为bytes的输入会选用的Strategy下标。
+     */
+    size_t choose(size_t bytes) const
+    {
+        if (m_table.empty())
+        {
+            return 0;
+        }
+        auto it = lower_bound(m_table.begin(), m_table.end(), bytes, [](const Decision &decision, size_t value) {
+            return decision.m_maxBytes < value;
+        });
+        return (it == m_table.end() ? m_table.back() : *it).m_strategy;
+    }
+
+    const vector<Decision> &decisionTable() const
+    {
+        return m_table;
+    }
+    const string &strategyName(size_t index) const
+    {
+        return m_names[index];
+    }
+
+    void printDecisionTable(ostream &os) const
+    {
+        os << "bytes <=";
+        for (const string &name : m_names)
+        {
+            os << ", " << name << " (ms)";
+        }
+        os << ", chosen\n";
+        for (const Decision &decision : m_table)
+        {
+            os << decision.m_maxBytes;
+            for (double ms : decision.m_timesMs)
+            {
+                os << ", " << ms;
+            }
+            os << ", " << m_names[decision.m_strategy] << "\n";
+        }
+    }
+
+private:
+    vector<string> m_names;
+    vector<unique_ptr<Strategy>> m_strategies;
+    vector<Decision> m_table;
 };
 
 /**
@@ -113,11 +1026,296 @@ void clientCode()
     cout << "Client: Strategy is set to do reverse sorting.\n";
     context->setStrategy(new ConcreteStrategyB);
     context->doBusiness();
+    cout << endl;
+    cout << "Client: Strategy is set to do counting sort in reverse order.\n";
+    context->setStrategy(new CountingSortStrategy(true));
+    context->doBusiness();
     delete context;
+    cout << endl;
+
+    cout << "Client: caller-owned input is sorted straight into a caller-owned buffer.\n";
+    string letters = "aecbd";
+    vector<string_view> views{string_view(letters).substr(0, 2), string_view(letters).substr(2)};
+    string output;
+    BufferSink sink(output);
+    Context viewContext(new ConcreteStrategyB);
+    viewContext.doBusiness(views, sink);
+    cout << output << endl;
+    cout << endl;
+
+    cout << "Client: strategies chosen at compile time are called without virtual dispatch.\n";
+    StaticContext<ConcreteStrategyA> staticContext;
+    cout << staticContext.doBusiness(vector<string>{"a", "e", "c", "b", "d"}) << endl;
+    VariantContext<ConcreteStrategyA, ConcreteStrategyB, CountingSortStrategy> variantContext{ConcreteStrategyA()};
+    variantContext.setStrategy(CountingSortStrategy(true));
+    cout << variantContext.doBusiness(vector<string>{"a", "e", "c", "b", "d"}) << endl;
+    cout << endl;
+
+    cout << "Client: AdaptiveContext picks the fastest strategy by input size.\n";
+    AdaptiveContext adaptive;
+    adaptive.addStrategy("A", new ConcreteStrategyA);
+    adaptive.addStrategy("counting", new CountingSortStrategy);
+    adaptive.calibrate({16, 4096, 65536});
+    adaptive.printDecisionTable(cout);
+    cout << adaptive.doBusiness(vector<string>{"a", "e", "c", "b", "d"}) << endl;
+    cout << endl;
+
+    cout << "Client: ExternalSortStrategy sorts a generated 4 MB stream with a 256 KB memory budget.\n";
+    mt19937 rng(11);
+    size_t remaining = 4 * 1024 * 1024;
+    GeneratorInputSource generator([&](char *buffer, size_t capacity) {
+        size_t n = min(capacity, remaining);
+        for (size_t i = 0; i < n; i++)
+        {
+            buffer[i] = (char)('a' + rng() % 26);
+        }
+        remaining -= n;
+        return n;
+    });
+    ostringstream sorted;
+    StreamingSortReport report = ExternalSortStrategy(256 * 1024).doAlgorithm(generator, sorted);
+    string sortedText = sorted.str();
+    cout << "sorted " << report.m_inputBytes << " bytes in order: " << is_sorted(sortedText.begin(), sortedText.end())
+         << ", runs " << report.m_runs << ", merge passes " << report.m_mergePasses
+         << ", temp written " << report.m_tempBytesWritten << ", temp read " << report.m_tempBytesRead
+         << ", peak memory " << report.m_peakMemoryBytes << endl;
+}
+
+/**
+ * 以下为性能测试代码，通过 `--bench [最大输入字节数]` 参数运行。
+ * 调用方的容器用CountingAllocator统计堆分配次数，Strategy内部的暂存区用ScratchBuffer::allocations()统计，
+ * 不替换全局operator new，不影响程序中的其他分配。
+ */
+static atomic<size_t> g_allocations(0);
+
+template <typename T>
+struct CountingAllocator
+{
+    using value_type = T;
+
+    CountingAllocator() noexcept {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        g_allocations.fetch_add(1, memory_order_relaxed);
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t) noexcept
+    {
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U> &) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U> &) const noexcept
+    {
+        return false;
+    }
+};
+
+using CountedString = basic_string<char, char_traits<char>, CountingAllocator<char>>;
+using CountedStrings = vector<CountedString, CountingAllocator<CountedString>>;
+
+/**
+ * 与BufferSink相同，但输出缓冲区的分配也被计数。
+ */
+class CountedBufferSink : public OutputSink
+{
+public:
+    explicit CountedBufferSink(CountedString &buffer) : m_buffer(buffer) {}
+    void write(const char *data, size_t size) override
+    {
+        m_buffer.append(data, size);
+    }
+
+private:
+    CountedString &m_buffer;
+};
+
+template <typename F>
+double measureMs(F &&f)
+{
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 }
 
-int main()
+void benchmarkCountingSort(size_t maxBytes)
 {
+    ConcreteStrategyA strategyA;
+    ConcreteStrategyB strategyB;
+    CountingSortStrategy counting, countingDescending(true);
+    const Strategy &b = strategyB;
+
+    cout << "bytes, A (ms), counting (ms), B (ms), counting descending (ms)\n";
+    for (size_t bytes = 1024; bytes <= maxBytes; bytes *= 4)
+    {
+        vector<string> data = makeInput(bytes);
+        string resultA, resultCounting, resultB, resultCountingDescending;
+        double aMs = measureMs([&] { resultA = strategyA.doAlgorithm(data); });
+        double countingMs = measureMs([&] { resultCounting = counting.doAlgorithm(data); });
+        double bMs = measureMs([&] { resultB = b.doAlgorithm(data); });
+        double countingDescendingMs = measureMs([&] { resultCountingDescending = countingDescending.doAlgorithm(data); });
+        bool same = resultA == resultCounting && resultB == resultCountingDescending;
+        cout << bytes << ", " << aMs << ", " << countingMs << ", " << bMs << ", " << countingDescendingMs
+             << (same ? "" : "  OUTPUT MISMATCH") << "\n";
+    }
+}
+
+/**
+ * 并行排序从1到2倍硬件线程数的扩展性，以及小输入时回退到顺序排序的效果。
+ */
+void benchmarkParallelSort(size_t maxBytes)
+{
+    ConcreteStrategyA strategyA;
+    size_t bytes = min(maxBytes, (size_t)32 * 1024 * 1024);
+    vector<string> data = makeInput(bytes);
+    string expected;
+    double aMs = measureMs([&] { expected = strategyA.doAlgorithm(data); });
+    cout << "parallel sort of " << bytes << " bytes, A: " << aMs << " ms\n";
+
+    size_t maxThreads = max(2u, thread::hardware_concurrency() * 2);
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        ParallelSortStrategy parallel(threads);
+        string result;
+        double ms = measureMs([&] { result = parallel.doAlgorithm(data); });
+        cout << "  " << threads << " threads: " << ms << " ms, speedup " << aMs / ms
+             << (result == expected ? "" : "  OUTPUT MISMATCH") << "\n";
+    }
+
+    vector<string> small = makeInput(4096);
+    ParallelSortStrategy withCutoff(maxThreads), withoutCutoff(maxThreads, 0);
+    double cutoffMs = measureMs([&] { for (int i = 0; i < 100; i++) withCutoff.doAlgorithm(small); });
+    double noCutoffMs = measureMs([&] { for (int i = 0; i < 100; i++) withoutCutoff.doAlgorithm(small); });
+    cout << "  4 KB input x100: sequential cutoff " << cutoffMs << " ms, always parallel " << noCutoffMs << " ms\n";
+}
+
+/**
+ * 每次doBusiness的堆分配次数：原来的vector<string>输入加string返回值 vs 调用方的视图加复用的输出缓冲区。
+ */
+void benchmarkDoBusinessAllocations()
+{
+    const int calls = 100000;
+    string letters = "the quick brown fox jumps over the lazy dog";
+    vector<string_view> views;
+    for (size_t i = 0; i < letters.size(); i += 8)
+    {
+        views.push_back(string_view(letters).substr(i, 8));
+    }
+    Strategy *strategies[] = {new ConcreteStrategyA, new CountingSortStrategy(true)};
+    const char *names[] = {"A", "counting descending"};
+
+    cout << "allocations per doBusiness call (" << letters.size() << " bytes in " << views.size() << " pieces)\n";
+    for (int s = 0; s < 2; s++)
+    {
+        Context context(strategies[s]);
+        size_t checksum = 0;
+        double copyMs = measureMs([&] {
+            for (int i = 0; i < calls; i++)
+            {
+                // 原来的调用方式：调用方的数据先复制成vector<string>，结果作为string返回
+                vector<string> data(views.begin(), views.end());
+                checksum += strategies[s]->doAlgorithm(data).size();
+            }
+        });
+        // 用计数分配器的同构容器重做调用方一侧的复制(各段字符串和返回的结果)，统计这部分的分配次数；
+        // 字符串版本Strategy内部的分配不在其中，所以这是下限
+        size_t before = g_allocations;
+        for (int i = 0; i < calls; i++)
+        {
+            CountedStrings data(views.begin(), views.end());
+            CountedString result(letters.size(), '\0');
+            checksum += data.size() + result.size();
+        }
+        double copyAllocations = (double)(g_allocations - before) / calls;
+
+        CountedString output;
+        CountedBufferSink sink(output);
+        before = g_allocations;
+        size_t scratchBefore = ScratchBuffer::allocations();
+        double viewMs = measureMs([&] {
+            for (int i = 0; i < calls; i++)
+            {
+                output.clear();
+                context.doBusiness(views, sink);
+                checksum += output.size();
+            }
+        });
+        double viewAllocations =
+            (double)(g_allocations - before + ScratchBuffer::allocations() - scratchBefore) / calls;
+
+        cout << "  " << names[s] << ": copies >= " << copyAllocations << " allocs/call, " << copyMs * 1000 / calls
+             << " us/call; views + sink " << viewAllocations << " allocs/call, " << viewMs * 1000 / calls
+             << " us/call (" << checksum << ")\n";
+    }
+}
+
+/**
+ * 16字节输入上的调用开销：虚调用的Context vs 模板StaticContext vs std::variant的VariantContext。
+ */
+void benchmarkCallOverhead()
+{
+    const int calls = 10000000;
+    string letters = "pnmolkjihgfedcba";
+    vector<string_view> views{string_view(letters).substr(0, 8), string_view(letters).substr(8)};
+    string output;
+    BufferSink sink(output);
+    size_t checksum = 0;
+
+    Context context(new ConcreteStrategyA);
+    double virtualMs = measureMs([&] {
+        for (int i = 0; i < calls; i++)
+        {
+            output.clear();
+            context.doBusiness(views, sink);
+            checksum += output[i & 15];
+        }
+    });
+
+    StaticContext<ConcreteStrategyA> staticContext;
+    double staticMs = measureMs([&] {
+        for (int i = 0; i < calls; i++)
+        {
+            output.clear();
+            staticContext.doBusiness(views, sink);
+            checksum += output[i & 15];
+        }
+    });
+
+    VariantContext<ConcreteStrategyA, ConcreteStrategyB, CountingSortStrategy> variantContext{ConcreteStrategyA()};
+    double variantMs = measureMs([&] {
+        for (int i = 0; i < calls; i++)
+        {
+            output.clear();
+            variantContext.doBusiness(views, sink);
+            checksum += output[i & 15];
+        }
+    });
+
+    cout << "call overhead on 16-byte inputs, " << calls << " calls (" << checksum << ")\n";
+    cout << "  virtual Context: " << virtualMs * 1e6 / calls << " ns/call\n";
+    cout << "  StaticContext:   " << staticMs * 1e6 / calls << " ns/call\n";
+    cout << "  VariantContext:  " << variantMs * 1e6 / calls << " ns/call\n";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        size_t maxBytes = argc > 2 ? stoull(argv[2]) : (size_t)64 * 1024 * 1024;
+        benchmarkCountingSort(maxBytes);
+        benchmarkParallelSort(maxBytes);
+        benchmarkDoBusinessAllocations();
+        benchmarkCallOverhead();
+        return 0;
+    }
     clientCode();
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,257 @@
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <typeindex>
+#include <iomanip>
+#include <type_traits>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <stdexcept>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
 using namespace std;
 
+/**
+ * templateMethod中的各个步骤，用于延迟统计。
+ */
+enum TemplateStep
+{
+    STEP_BASE_OPERATION_1 = 0,
+    STEP_REQUIRED_OPERATION_1,
+    STEP_BASE_OPERATION_2,
+    STEP_HOOK_1,
+    STEP_REQUIRED_OPERATION_2,
+    STEP_BASE_OPERATION_3,
+    STEP_HOOK_2,
+    STEP_COUNT
+};
+
+static const char *const kStepNames[STEP_COUNT] = {
+    "baseOperation1", "requiredOperation1", "baseOperation2", "hook1",
+    "requiredOperation2", "baseOperation3", "hook2"};
+
+/**
+ * 对数-线性的延迟直方图(单位纳秒)：按2的幂分成若干段，每段再等分为kSubBuckets个桶，相对误差不超过1/kSubBuckets。
+ * 计数是原子的，多个线程可以同时记录。
+ */
+class LatencyHistogram
+{
+public:
+    static const int kSubBuckets = 8;
+    static const int kBucketCount = 64 * kSubBuckets;
+
+    LatencyHistogram()
+    {
+        for (atomic<uint64_t> &bucket : m_buckets)
+        {
+            bucket.store(0, memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t nanoseconds)
+    {
+        m_buckets[bucketOf(nanoseconds)].fetch_add(1, memory_order_relaxed);
+        uint64_t max = m_max.load(memory_order_relaxed);
+        while (nanoseconds > max && !m_max.compare_exchange_weak(max, nanoseconds, memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (const atomic<uint64_t> &bucket : m_buckets)
+        {
+            total += bucket.load(memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t max() const
+    {
+        return m_max.load(memory_order_relaxed);
+    }
+
+    /**
+     * 第p百分位(0 < p <= 100)的延迟，返回所在桶的上界。没有记录时返回0。
+     */
+    uint64_t percentile(double p) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(p / 100. * total + 0.5);
+        rank = rank == 0 ? 1 : rank;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBucketCount; i++)
+        {
+            seen += m_buckets[i].load(memory_order_relaxed);
+            if (seen >= rank)
+            {
+                return std::min(upperBound(i), max());
+            }
+        }
+        return max();
+    }
+
+private:
+    static int bucketOf(uint64_t value)
+    {
+        if (value < kSubBuckets)
+        {
+            return (int)value;
+        }
+        int exponent = 63;
+        while (!(value >> exponent))
+        {
+            exponent--;
+        }
+        // exponent >= 3：[2^exponent, 2^(exponent+1))等分为kSubBuckets个桶
+        int sub = (int)((value >> (exponent - 3)) & (kSubBuckets - 1));
+        return (exponent - 2) * kSubBuckets + sub;
+    }
+    static uint64_t upperBound(int bucket)
+    {
+        if (bucket < kSubBuckets)
+        {
+            return bucket;
+        }
+        int exponent = bucket / kSubBuckets + 2, sub = bucket % kSubBuckets;
+        return ((uint64_t)(kSubBuckets + sub + 1) << (exponent - 3)) - 1;
+    }
+
+    atomic<uint64_t> m_buckets[kBucketCount];
+    atomic<uint64_t> m_max{0};
+};
+
+/**
+ * 一个具体类的各个步骤的延迟直方图。
+ */
+struct StepStats
+{
+    string m_className;
+    LatencyHistogram m_steps[STEP_COUNT];
+};
+
+/**
+ * StepProfiler记录每个具体类、每个步骤的延迟。默认关闭：关闭时templateMethod只多读一次原子变量。
+ */
+class StepProfiler
+{
+public:
+    static StepProfiler &instance()
+    {
+        static StepProfiler profiler;
+        return profiler;
+    }
+
+    static bool enabled()
+    {
+        return instance().m_enabled.load(memory_order_relaxed);
+    }
+    void setEnabled(bool enabled)
+    {
+        m_enabled.store(enabled, memory_order_relaxed);
+    }
+
+    /**
+     * 取得某个具体类的统计数据，第一次访问时创建。返回的引用在程序结束前一直有效。
+     */
+    StepStats &statsFor(const type_info &type)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        unique_ptr<StepStats> &stats = m_stats[type_index(type)];
+        if (!stats)
+        {
+            stats.reset(new StepStats);
+            stats->m_className = demangle(type.name());
+        }
+        return *stats;
+    }
+
+    /**
+     * 查找某个具体类某个步骤的直方图，没有记录过时返回nullptr。
+     */
+    const LatencyHistogram *histogram(const string &className, TemplateStep step)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        for (auto &entry : m_stats)
+        {
+            if (entry.second->m_className == className)
+            {
+                return &entry.second->m_steps[step];
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * 输出每个具体类每个步骤的调用次数和p50/p90/p99/max延迟(纳秒)。
+     */
+    void dump(ostream &os)
+    {
+        lock_guard<mutex> lock(m_mutex);
+        os << left << setw(20) << "class" << setw(20) << "step" << right << setw(10) << "count" << setw(10)
+           << "p50(ns)" << setw(10) << "p90(ns)" << setw(10) << "p99(ns)" << setw(10) << "max(ns)" << "\n";
+        for (auto &entry : m_stats)
+        {
+            for (int step = 0; step < STEP_COUNT; step++)
+            {
+                const LatencyHistogram &histogram = entry.second->m_steps[step];
+                os << left << setw(20) << entry.second->m_className << setw(20) << kStepNames[step] << right
+                   << setw(10) << histogram.count() << setw(10) << histogram.percentile(50) << setw(10)
+                   << histogram.percentile(90) << setw(10) << histogram.percentile(99) << setw(10)
+                   << histogram.max() << "\n";
+            }
+        }
+    }
+
+private:
+    StepProfiler() : m_enabled(false) {}
+
+    static string demangle(const char *name)
+    {
+#ifdef __GNUG__
+        int status = 0;
+        char *readable = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status == 0 && readable)
+        {
+            string result(readable);
+            free(readable);
+            return result;
+        }
+#endif
+        return name;
+    }
+
+    atomic<bool> m_enabled;
+    mutex m_mutex;
+    map<type_index, unique_ptr<StepStats>> m_stats;
+};
+
+/**
+ * 基类操作的公共实现，AbstractClass和StaticAbstractClass共用。log为空时不做任何输出。
+ */
+inline void logBaseOperation(ostream *log, const char *className, TemplateStep step)
+{
+    if (log != nullptr)
+    {
+        *log << className << " : I am doing the bulk of the work " << kStepNames[step] << "!" << endl;
+    }
+}
+
 /**
  * 模板方法模式
  * 抽象类定义了一个模板方法，该方法包含一些算法的骨架，(通常)由抽象的原始操作的调用组成。
@@ -10,10 +261,16 @@ class AbstractClass
 {
 public:
     /**
-     * 模板方法定义的算法框架
+     * 模板方法定义的算法框架。
+     * StepProfiler开启时记录每个步骤的耗时，关闭时直接执行各个步骤。
      */
     void templateMethod() const
     {
+        if (StepProfiler::enabled())
+        {
+            profiledTemplateMethod();
+            return;
+        }
         this->baseOperation1();
         this->requiredOperation1();
         this->baseOperation2();
@@ -22,6 +279,16 @@ public:
         this->baseOperation3();
         this->hook2();
     }
+    AbstractClass() {}
+    // 基类操作输出到log，传入nullptr则不输出
+    explicit AbstractClass(ostream *log) : m_log(log) {}
+    // 统计数据的缓存不随对象拷贝，拷贝出的对象第一次统计时重新查找
+    AbstractClass(const AbstractClass &other) : m_log(other.m_log) {}
+    AbstractClass &operator=(const AbstractClass &other)
+    {
+        m_log = other.m_log;
+        return *this;
+    }
     virtual ~AbstractClass() {}
 
 protected:
@@ -30,17 +297,17 @@ protected:
      */
     void baseOperation1() const
     {
-        cout << "AbstractClass : I am doing the bulk of the work baseOperation1!" << endl;
+        logBaseOperation(m_log, "AbstractClass", STEP_BASE_OPERATION_1);
     }
 
     void baseOperation2() const
     {
-        cout << "AbstractClass : I am doing the bulk of the work baseOperation2!" << endl;
+        logBaseOperation(m_log, "AbstractClass", STEP_BASE_OPERATION_2);
     }
 
     void baseOperation3() const
     {
-        cout << "AbstractClass : I am doing the bulk of the work baseOperation3!" << endl;
+        logBaseOperation(m_log, "AbstractClass", STEP_BASE_OPERATION_3);
     }
 
     /**
@@ -55,6 +322,72 @@ protected:
      */
     virtual void hook1() const {}
     virtual void hook2() const {}
+
+private:
+    friend class TemplatePipeline;
+
+    /**
+     * 单独执行templateMethod中的一个步骤，只供TemplatePipeline使用。
+     * 调用者负责按TemplateStep的顺序执行全部步骤；这里不做延迟统计。
+     */
+    void runStep(TemplateStep step) const
+    {
+        switch (step)
+        {
+        case STEP_BASE_OPERATION_1:
+            this->baseOperation1();
+            break;
+        case STEP_REQUIRED_OPERATION_1:
+            this->requiredOperation1();
+            break;
+        case STEP_BASE_OPERATION_2:
+            this->baseOperation2();
+            break;
+        case STEP_HOOK_1:
+            this->hook1();
+            break;
+        case STEP_REQUIRED_OPERATION_2:
+            this->requiredOperation2();
+            break;
+        case STEP_BASE_OPERATION_3:
+            this->baseOperation3();
+            break;
+        case STEP_HOOK_2:
+            this->hook2();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void profiledTemplateMethod() const
+    {
+        StepStats *stats = m_stats.load(memory_order_acquire);
+        if (stats == nullptr)
+        {
+            stats = &StepProfiler::instance().statsFor(typeid(*this));
+            m_stats.store(stats, memory_order_release);
+        }
+        timeStep(*stats, STEP_BASE_OPERATION_1, &AbstractClass::baseOperation1);
+        timeStep(*stats, STEP_REQUIRED_OPERATION_1, &AbstractClass::requiredOperation1);
+        timeStep(*stats, STEP_BASE_OPERATION_2, &AbstractClass::baseOperation2);
+        timeStep(*stats, STEP_HOOK_1, &AbstractClass::hook1);
+        timeStep(*stats, STEP_REQUIRED_OPERATION_2, &AbstractClass::requiredOperation2);
+        timeStep(*stats, STEP_BASE_OPERATION_3, &AbstractClass::baseOperation3);
+        timeStep(*stats, STEP_HOOK_2, &AbstractClass::hook2);
+    }
+
+    void timeStep(StepStats &stats, TemplateStep step, void (AbstractClass::*operation)() const) const
+    {
+        auto start = chrono::steady_clock::now();
+        (this->*operation)();
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        stats.m_steps[step].record((uint64_t)elapsed.count());
+    }
+
+    ostream *m_log = &cout;
+    // 第一次统计时缓存本对象所属具体类的统计数据，之后不用再查表
+    mutable atomic<StepStats *> m_stats{nullptr};
 };
 
 /**
@@ -97,6 +430,370 @@ protected:
     }
 };
 
+/**
+ * CRTP版本的模板方法：基类以具体类作为模板参数，所有步骤在编译期解析为普通的(可内联的)调用，没有虚函数。
+ * 必需操作没有默认实现，具体类不实现就会编译失败(相当于纯虚函数)；
+ * 钩子有空的默认实现，并且用if constexpr判断具体类是否自己声明了钩子，没有声明时调用在编译期被完全删除。
+ * 具体类的操作一般是protected的，需要把基类声明为友元。
+ */
+template <typename Derived>
+class StaticAbstractClass
+{
+public:
+    void templateMethod() const
+    {
+        this->baseOperation1();
+        derived().requiredOperation1();
+        this->baseOperation2();
+        if constexpr (overridesHook1())
+        {
+            derived().hook1();
+        }
+        derived().requiredOperation2();
+        this->baseOperation3();
+        if constexpr (overridesHook2())
+        {
+            derived().hook2();
+        }
+    }
+
+protected:
+    StaticAbstractClass() {}
+    explicit StaticAbstractClass(ostream *log) : m_log(log) {}
+
+    void baseOperation1() const
+    {
+        logBaseOperation(m_log, "StaticAbstractClass", STEP_BASE_OPERATION_1);
+    }
+
+    void baseOperation2() const
+    {
+        logBaseOperation(m_log, "StaticAbstractClass", STEP_BASE_OPERATION_2);
+    }
+
+    void baseOperation3() const
+    {
+        logBaseOperation(m_log, "StaticAbstractClass", STEP_BASE_OPERATION_3);
+    }
+
+    void hook1() const {}
+    void hook2() const {}
+
+private:
+    const Derived &derived() const
+    {
+        return static_cast<const Derived &>(*this);
+    }
+
+    ostream *m_log = &cout;
+
+    /**
+     * 具体类没有声明钩子时，&Derived::hook1就是基类的成员指针，类型与基类的相同。
+     */
+    static constexpr bool overridesHook1()
+    {
+        return !is_same<decltype(&Derived::hook1), decltype(&StaticAbstractClass::hook1)>::value;
+    }
+    static constexpr bool overridesHook2()
+    {
+        return !is_same<decltype(&Derived::hook2), decltype(&StaticAbstractClass::hook2)>::value;
+    }
+};
+
+class StaticConcreteClass1 : public StaticAbstractClass<StaticConcreteClass1>
+{
+    friend class StaticAbstractClass<StaticConcreteClass1>;
+
+protected:
+    void requiredOperation1() const
+    {
+        cout << "StaticConcreteClass1 : Implemented requiredOperation1." << endl;
+    }
+
+    void requiredOperation2() const
+    {
+        cout << "StaticConcreteClass1 : Implemented requiredOperation2." << endl;
+    }
+};
+
+class StaticConcreteClass2 : public StaticAbstractClass<StaticConcreteClass2>
+{
+    friend class StaticAbstractClass<StaticConcreteClass2>;
+
+protected:
+    void requiredOperation1() const
+    {
+        cout << "StaticConcreteClass2 : Implemented requiredOperation1." << endl;
+    }
+
+    void requiredOperation2() const
+    {
+        cout << "StaticConcreteClass2 : Implemented requiredOperation2." << endl;
+    }
+
+    void hook1() const
+    {
+        cout << "StaticConcreteClass2 : Overriden hook1." << endl;
+    }
+};
+
+/**
+ * 有界的单生产者单消费者环形队列。容量取2的幂；生产者和消费者各自缓存对方的下标，
+ * 只有在看起来满/空时才重新读取对方的原子变量，减少缓存行来回传递。
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : m_mask(roundUpToPowerOfTwo(capacity) - 1), m_slots(m_mask + 1) {}
+
+    bool tryPush(const T &value)
+    {
+        size_t tail = m_tail.load(memory_order_relaxed);
+        if (tail - m_cachedHead > m_mask)
+        {
+            m_cachedHead = m_head.load(memory_order_acquire);
+            if (tail - m_cachedHead > m_mask)
+            {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = value;
+        m_tail.store(tail + 1, memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &value)
+    {
+        size_t head = m_head.load(memory_order_relaxed);
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = m_tail.load(memory_order_acquire);
+            if (head == m_cachedTail)
+            {
+                return false;
+            }
+        }
+        value = m_slots[head & m_mask];
+        m_head.store(head + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * 阻塞版本：先自旋，再让出CPU，仍然不成功就在条件变量上休眠，直到对方取走或放入元素后唤醒。
+     * 对方长时间不动(例如上一个流水级在执行很慢的步骤)时不会一直占用CPU。
+     */
+    void push(const T &value)
+    {
+        waitUntil([&]
+                  { return tryPush(value); });
+        wakeParked();
+    }
+
+    T pop()
+    {
+        T value;
+        waitUntil([&]
+                  { return tryPop(value); });
+        wakeParked();
+        return value;
+    }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 2;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    template <typename Attempt>
+    void waitUntil(Attempt attempt)
+    {
+        for (int spins = 0; spins < 128; spins++)
+        {
+            if (attempt())
+            {
+                return;
+            }
+            if (spins >= 64)
+            {
+                this_thread::yield();
+            }
+        }
+        // 登记为休眠后再尝试一次，对方操作之后会看到m_parked > 0，不会丢失唤醒
+        unique_lock<mutex> lock(m_parkMutex);
+        m_parked.fetch_add(1);
+        atomic_thread_fence(memory_order_seq_cst);
+        m_wakeUp.wait(lock, attempt);
+        m_parked.fetch_sub(1);
+    }
+
+    /**
+     * 队列不会同时满和空，所以休眠的只可能是对方。
+     */
+    void wakeParked()
+    {
+        // 与waitUntil中的栅栏配对：要么这里看到对方休眠，要么对方再次尝试时看到这次操作
+        atomic_thread_fence(memory_order_seq_cst);
+        if (m_parked.load(memory_order_relaxed) > 0)
+        {
+            lock_guard<mutex> lock(m_parkMutex);
+            m_wakeUp.notify_one();
+        }
+    }
+
+    const size_t m_mask;
+    vector<T> m_slots;
+    // 消费者写m_head，生产者写m_tail，分别放在不同的缓存行上
+    alignas(64) atomic<size_t> m_head{0};
+    size_t m_cachedTail = 0;
+    alignas(64) atomic<size_t> m_tail{0};
+    size_t m_cachedHead = 0;
+    alignas(64) atomic<int> m_parked{0};
+    mutex m_parkMutex;
+    condition_variable m_wakeUp;
+};
+
+/**
+ * 批量执行templateMethod的流水线：每个流水级是一个独立线程，负责连续的若干个步骤，相邻流水级之间用有界SPSC队列连接。
+ * 第N个对象还在执行requiredOperation2时，第N+1个对象已经可以开始baseOperation1。
+ * 每个对象的步骤仍然按templateMethod的顺序执行，队列是FIFO的，所以对象完成的顺序与输入顺序一致。
+ * 吞吐量受最慢的流水级限制，步骤耗时越均衡收益越大。
+ * 流水级数量不超过maxStages(默认为硬件线程数)和步骤数，核数少时几个步骤合并到一个流水级，避免线程比核多。
+ */
+class TemplatePipeline
+{
+public:
+    explicit TemplatePipeline(size_t queueCapacity = 256, size_t maxStages = thread::hardware_concurrency())
+        : m_queueCapacity(queueCapacity), m_stageCount(min(max(maxStages, (size_t)1), (size_t)STEP_COUNT))
+    {
+    }
+
+    size_t stageCount() const
+    {
+        return m_stageCount;
+    }
+
+    /**
+     * 依次处理items中的所有对象。每个对象完成全部步骤后，在最后一个流水级的线程上按输入顺序调用onComplete(index, item)。
+     * items中不能有nullptr，同一个对象也不能出现多次(不同步骤会在不同线程上同时访问它)。
+     * 某个步骤或onComplete抛出异常时，之后不再执行任何步骤，各流水级只把剩下的对象传下去直到排空，
+     * 然后由run重新抛出第一个异常。
+     */
+    template <typename OnComplete>
+    void run(const vector<const AbstractClass *> &items, OnComplete onComplete) const
+    {
+        for (const AbstractClass *item : items)
+        {
+            if (item == nullptr)
+            {
+                throw invalid_argument("TemplatePipeline: null item");
+            }
+        }
+
+        vector<unique_ptr<SpscQueue<const AbstractClass *>>> queues;
+        for (size_t stage = 0; stage < m_stageCount; stage++)
+        {
+            queues.emplace_back(new SpscQueue<const AbstractClass *>(m_queueCapacity));
+        }
+
+        atomic<bool> failed{false};
+        mutex errorMutex;
+        exception_ptr error;
+        vector<thread> stages;
+        for (size_t stage = 0; stage < m_stageCount; stage++)
+        {
+            stages.emplace_back([&, stage]
+                                {
+                SpscQueue<const AbstractClass *> &input = *queues[stage];
+                int firstStep = (int)(stage * STEP_COUNT / m_stageCount);
+                int lastStep = (int)((stage + 1) * STEP_COUNT / m_stageCount);
+                bool lastStage = stage + 1 == m_stageCount;
+                // 每个流水级恰好处理items.size()个对象，不需要结束标记
+                for (size_t index = 0; index < items.size(); index++)
+                {
+                    const AbstractClass *item = input.pop();
+                    if (!failed.load(memory_order_relaxed))
+                    {
+                        try
+                        {
+                            for (int step = firstStep; step < lastStep; step++)
+                            {
+                                item->runStep((TemplateStep)step);
+                            }
+                            if (lastStage)
+                            {
+                                onComplete(index, item);
+                            }
+                        }
+                        catch (...)
+                        {
+                            lock_guard<mutex> lock(errorMutex);
+                            if (!error)
+                            {
+                                error = current_exception();
+                            }
+                            failed.store(true, memory_order_relaxed);
+                        }
+                    }
+                    if (!lastStage)
+                    {
+                        queues[stage + 1]->push(item);
+                    }
+                } });
+        }
+
+        for (const AbstractClass *item : items)
+        {
+            queues[0]->push(item);
+        }
+        for (thread &stage : stages)
+        {
+            stage.join();
+        }
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+    }
+
+private:
+    size_t m_queueCapacity;
+    size_t m_stageCount;
+};
+
+/**
+ * 记录自己的可扩展步骤的执行顺序，用于演示流水线保持了每个对象的步骤顺序。
+ */
+class TracingClass : public AbstractClass
+{
+public:
+    // 基类操作的输出在多个流水级线程上会交错，演示时不输出
+    TracingClass() : AbstractClass(nullptr) {}
+
+    mutable string m_trace;
+
+protected:
+    void requiredOperation1() const override
+    {
+        m_trace += "requiredOperation1 ";
+    }
+
+    void requiredOperation2() const override
+    {
+        m_trace += "requiredOperation2 ";
+    }
+
+    void hook2() const override
+    {
+        m_trace += "hook2";
+    }
+};
+
 /**
  * 客户端代码调用模板方法来执行算法。
  * 客户端代码不需要知道它所处理的对象的具体类，只要它通过对象基类的接口来处理它们就可以了。
@@ -108,8 +805,205 @@ void ClientCode(AbstractClass *p_class)
     // ...
 }
 
-int main()
+/**
+ * CRTP版本的客户端代码在编译期就知道具体类。
+ */
+template <typename T>
+void StaticClientCode(const StaticAbstractClass<T> &object)
+{
+    object.templateMethod();
+}
+
+/**
+ * 以下为性能测试代码，通过 `--bench` 参数运行。
+ * 基类操作不输出，可扩展步骤只做一次累加，从而突出调用本身的开销；两个版本的具体类都不重载hook。
+ */
+class CountingVirtualClass : public AbstractClass
+{
+public:
+    CountingVirtualClass() : AbstractClass(nullptr) {}
+
+    mutable uint64_t m_counter = 0;
+
+protected:
+    void requiredOperation1() const override
+    {
+        m_counter += 1;
+    }
+    void requiredOperation2() const override
+    {
+        m_counter += 2;
+    }
+};
+
+class CountingStaticClass : public StaticAbstractClass<CountingStaticClass>
+{
+    friend class StaticAbstractClass<CountingStaticClass>;
+
+public:
+    CountingStaticClass() : StaticAbstractClass(nullptr) {}
+
+    mutable uint64_t m_counter = 0;
+
+protected:
+    void requiredOperation1() const
+    {
+        m_counter += 1;
+    }
+    void requiredOperation2() const
+    {
+        m_counter += 2;
+    }
+};
+
+template <typename F>
+double measureMs(F f)
+{
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+template <typename F>
+double measureNsPerCall(long long calls, F f)
+{
+    auto start = chrono::steady_clock::now();
+    for (long long i = 0; i < calls; i++)
+    {
+        f();
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / calls;
+}
+
+/**
+ * 对象通过volatile指针取得，避免编译器在测试循环里看穿虚函数版本的动态类型，或把CRTP版本的整个循环折叠成一次加法。
+ */
+void benchmarkStaticDispatch(long long calls)
+{
+    CountingVirtualClass virtualObject;
+    CountingStaticClass staticObject;
+    const AbstractClass *volatile p_virtual = &virtualObject;
+    const CountingStaticClass *volatile p_static = &staticObject;
+
+    double virtualNs = measureNsPerCall(calls, [&]
+                                        { p_virtual->templateMethod(); });
+    double staticNs = measureNsPerCall(calls, [&]
+                                       { StaticClientCode(*p_static); });
+
+    cout << "templateMethod() x " << calls << "\n";
+    cout << fixed << setprecision(2);
+    cout << "  virtual AbstractClass   : " << virtualNs << " ns/call (checksum " << virtualObject.m_counter << ")\n";
+    cout << "  CRTP StaticAbstractClass: " << staticNs << " ns/call (checksum " << staticObject.m_counter << ")\n";
+    cout << "  speedup: " << virtualNs / staticNs << "x" << endl;
+}
+
+/**
+ * 可扩展步骤各自做一定量的计算，用于测试流水线在步骤耗时均衡/不均衡时的吞吐量。
+ */
+class BusyClass : public AbstractClass
+{
+public:
+    // 依次为requiredOperation1、hook1、requiredOperation2、hook2的计算量
+    explicit BusyClass(const uint64_t *work) : AbstractClass(nullptr), m_work(work) {}
+
+    mutable uint64_t m_sink = 0;
+
+protected:
+    void requiredOperation1() const override
+    {
+        burn(m_work[0]);
+    }
+    void hook1() const override
+    {
+        burn(m_work[1]);
+    }
+    void requiredOperation2() const override
+    {
+        burn(m_work[2]);
+    }
+    void hook2() const override
+    {
+        burn(m_work[3]);
+    }
+
+private:
+    void burn(uint64_t iterations) const
+    {
+        uint64_t x = m_sink + iterations;
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        m_sink = x;
+    }
+
+    const uint64_t *m_work;
+};
+
+void benchmarkPipeline(size_t itemCount)
+{
+    const uint64_t unit = 2000;
+    struct Profile
+    {
+        const char *name;
+        uint64_t work[4];
+    } profiles[] = {{"balanced", {unit, unit, unit, unit}},
+                    {"unbalanced", {unit * 5 / 2, unit / 2, unit / 2, unit / 2}}};
+
+    TemplatePipeline pipeline;
+    size_t stageCount = pipeline.stageCount();
+    cout << "pipelined templateMethod, " << itemCount << " items, " << stageCount << " stages, "
+         << thread::hardware_concurrency() << " hardware threads\n";
+    for (const Profile &profile : profiles)
+    {
+        vector<BusyClass> objects(itemCount, BusyClass(profile.work));
+        vector<const AbstractClass *> items;
+        for (const BusyClass &object : objects)
+        {
+            items.push_back(&object);
+        }
+
+        double sequentialMs = measureMs([&]
+                                        {
+            for (const AbstractClass *item : items)
+            {
+                item->templateMethod();
+            } });
+        bool ordered = true;
+        double pipelinedMs = measureMs([&]
+                                       { pipeline.run(items, [&](size_t index, const AbstractClass *item)
+                                                                { ordered = ordered && items[index] == item; }); });
+
+        // 按流水线的划分把各步骤的计算量合并到流水级上，最慢的流水级决定加速比的上限
+        const uint64_t stepWork[STEP_COUNT] = {0, profile.work[0], 0, profile.work[1], profile.work[2], 0, profile.work[3]};
+        uint64_t total = 0, slowest = 0;
+        for (size_t stage = 0; stage < stageCount; stage++)
+        {
+            uint64_t stageWork = 0;
+            for (size_t step = stage * STEP_COUNT / stageCount; step < (stage + 1) * STEP_COUNT / stageCount; step++)
+            {
+                stageWork += stepWork[step];
+            }
+            total += stageWork;
+            slowest = std::max(slowest, stageWork);
+        }
+        cout << fixed << setprecision(2);
+        cout << "  " << left << setw(12) << profile.name << right << "sequential " << setw(8) << sequentialMs
+             << " ms, pipelined " << setw(8) << pipelinedMs << " ms, speedup " << sequentialMs / pipelinedMs
+             << "x (bound " << (double)total / slowest << "x), order " << (ordered ? "preserved" : "BROKEN") << "\n";
+    }
+}
+
+int main(int argc, char *argv[])
 {
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        long long calls = argc > 2 ? atoll(argv[2]) : 10000000;
+        benchmarkStaticDispatch(calls);
+        benchmarkPipeline(20000);
+        return 0;
+    }
+
     cout << "Same client code can work with different subclasses:\n";
     ConcreteClass1 *concreteClass1 = new ConcreteClass1;
     ClientCode(concreteClass1);
@@ -117,8 +1011,40 @@ int main()
     cout << "Same client code can work with different subclasses:\n";
     ConcreteClass2 *concreteClass2 = new ConcreteClass2;
     ClientCode(concreteClass2);
+
+    cout << "\nPer-step latency with StepProfiler enabled:\n";
+    StepProfiler::instance().setEnabled(true);
+    for (int i = 0; i < 10; i++)
+    {
+        ClientCode(concreteClass1);
+        ClientCode(concreteClass2);
+    }
+    StepProfiler::instance().setEnabled(false);
+    StepProfiler::instance().dump(cout);
     delete concreteClass1;
     delete concreteClass2;
 
+    cout << "\nSame template method resolved at compile time (CRTP):\n";
+    StaticConcreteClass1 staticClass1;
+    StaticClientCode(staticClass1);
+    cout << endl;
+    StaticConcreteClass2 staticClass2;
+    StaticClientCode(staticClass2);
+
+    cout << "\nBatch of objects through the step pipeline:\n";
+    vector<TracingClass> tracing(4);
+    vector<const AbstractClass *> batch;
+    for (const TracingClass &object : tracing)
+    {
+        batch.push_back(&object);
+    }
+    vector<size_t> completed;
+    TemplatePipeline().run(batch, [&](size_t index, const AbstractClass *)
+                           { completed.push_back(index); });
+    for (size_t index : completed)
+    {
+        cout << "item " << index << ": " << tracing[index].m_trace << "\n";
+    }
+
     return 0;
 }
\ No newline at end of file